@@ -0,0 +1,423 @@
+﻿#include "ApplyDisturbance.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include "lib/OlsApi.h"
+#include "Msr.h"
+#include "PowerState.h"
+#include "Statistics.h"
+#include "Threads.h"
+#include "Trace.h"
+#include "Tsc.h"
+
+// constants
+static constexpr unsigned int HWCONF_REGISTER{ 0xC0010015 };
+static constexpr ApplyStrategy STRATEGIES[]{ ApplyStrategy::NONE, ApplyStrategy::SERIAL, ApplyStrategy::PINNED, ApplyStrategy::BATCHED };
+static constexpr int NUM_STRATEGIES{ 4 };
+
+// the window stays open a little after the apply, a victim that was descheduled by the last
+// write needs to run again to notice its stall
+static constexpr DWORD SETTLE_MS{ 2 };
+static constexpr DWORD PAUSE_MS{ 20 };
+static constexpr int NO_WINDOW{ -1 };
+
+// one register write of an apply
+struct RegisterWrite
+{
+	unsigned int reg;
+	uint64_t value;
+};
+
+// prototypes
+static std::vector<std::vector<RegisterWrite>> planWrites(int pstate, int numThreads);
+static void writeOnCurrentThread(const std::vector<RegisterWrite>& writes);
+static void applySerial(const std::vector<std::vector<RegisterWrite>>& writes);
+static void applyBatched(const std::vector<std::vector<RegisterWrite>>& writes);
+
+// one worker pinned to every hardware thread, started once so the apply itself doesn't create threads
+class PinnedWriters
+{
+public:
+	explicit PinnedWriters(const std::vector<std::vector<RegisterWrite>>& writes)
+		:writes(writes), generation(0), pending(0), stopping(false)
+	{
+		for (int thread = 0; thread < (int)writes.size(); thread++)
+		{
+			workers.emplace_back([this, thread]() { run(thread); });
+		}
+	}
+
+	virtual ~PinnedWriters()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+
+		for (std::thread& worker : workers)
+		{
+			worker.join();
+		}
+	}
+
+	PinnedWriters(const PinnedWriters&) = delete;
+	PinnedWriters& operator=(const PinnedWriters&) = delete;
+
+	void apply()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		pending = (int)workers.size();
+		generation++;
+		wake.notify_all();
+		done.wait(lock, [this]() { return pending == 0; });
+
+		if (error)
+		{
+			std::rethrow_exception(error);
+		}
+	}
+
+private:
+	const std::vector<std::vector<RegisterWrite>>& writes;
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	uint64_t generation;
+	int pending;
+	bool stopping;
+	std::exception_ptr error;
+
+	void run(int thread)
+	{
+		uint64_t seen = 0;
+		bool pinned = false;
+		std::exception_ptr pinError;
+		try
+		{
+			pinCurrentThread(thread);
+			SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_ABOVE_NORMAL);
+			pinned = true;
+		}
+		catch (...)
+		{
+			pinError = std::current_exception();
+		}
+
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true)
+		{
+			wake.wait(lock, [&]() { return stopping || generation != seen; });
+			if (stopping)
+			{
+				return;
+			}
+			seen = generation;
+
+			lock.unlock();
+			std::exception_ptr writeError = pinError;
+			if (pinned)
+			{
+				try
+				{
+					writeOnCurrentThread(writes[thread]);
+				}
+				catch (...)
+				{
+					writeError = std::current_exception();
+				}
+			}
+			lock.lock();
+
+			if (writeError && !error)
+			{
+				error = writeError;
+			}
+			if (--pending == 0)
+			{
+				done.notify_all();
+			}
+		}
+	}
+};
+
+const char* formatApplyStrategy(ApplyStrategy strategy)
+{
+	switch (strategy)
+	{
+	case ApplyStrategy::SERIAL:
+		return "serial";
+	case ApplyStrategy::PINNED:
+		return "pinned";
+	case ApplyStrategy::BATCHED:
+		return "batched";
+	default:
+		return "none";
+	}
+}
+
+std::vector<DisturbanceResult> measureApplyDisturbance(DWORD_PTR victimMask, int pstate, int repetitions, int numThreads)
+{
+	TraceSpan span("measureApplyDisturbance", "pstate", pstate);
+
+	if (repetitions <= 0)
+	{
+		throw std::invalid_argument("Number of repetitions must be positive");
+	}
+
+	std::vector<std::vector<RegisterWrite>> writes = planWrites(pstate, numThreads);
+	std::vector<int> victims = getThreadsInMask(victimMask);
+	int numWindows = NUM_STRATEGIES * repetitions;
+
+	// every victim keeps the longest iteration of every window, written only by that victim
+	std::vector<std::vector<uint64_t>> longest(victims.size(), std::vector<uint64_t>(numWindows, 0));
+	std::atomic<int> window{ NO_WINDOW };
+	std::atomic<bool> stop{ false };
+	std::atomic<int> ready{ 0 };
+	std::atomic<bool> failed{ false };
+	std::exception_ptr error;
+
+	std::vector<std::thread> victimThreads;
+	for (size_t v = 0; v < victims.size(); v++)
+	{
+		victimThreads.emplace_back([&, v]() {
+			try
+			{
+				pinCurrentThread(victims[v]);
+			}
+			catch (...)
+			{
+				if (!failed.exchange(true))
+				{
+					error = std::current_exception();
+				}
+				ready++;
+				return;
+			}
+			ready++;
+
+			// a small dependent computation per iteration, like a request loop of a service
+			uint64_t state = victims[v] + 1;
+			uint64_t last = readTsc();
+			while (!stop.load(std::memory_order_relaxed))
+			{
+				state = state * 6364136223846793005ull + 1442695040888963407ull;
+				uint64_t now = readTsc();
+				int current = window.load(std::memory_order_relaxed);
+				if (current != NO_WINDOW && now - last > longest[v][current])
+				{
+					longest[v][current] = now - last;
+				}
+				last = now;
+			}
+
+			// keeps the computation from being optimized away
+			volatile uint64_t sink = state;
+		});
+	}
+
+	std::vector<DisturbanceResult> results;
+	try
+	{
+		while (ready < (int)victims.size())
+		{
+			Sleep(1);
+		}
+
+		if (error)
+		{
+			std::rethrow_exception(error);
+		}
+
+		PinnedWriters pinnedWriters(writes);
+
+		for (int s = 0; s < NUM_STRATEGIES; s++)
+		{
+			DisturbanceResult result;
+			result.strategy = STRATEGIES[s];
+			result.threads = victims;
+
+			for (int r = 0; r < repetitions; r++)
+			{
+				TraceSpan applySpan(formatApplyStrategy(result.strategy), "repetition", r);
+				Sleep(PAUSE_MS);
+				window = s * repetitions + r;
+
+				// the applying thread runs above the victims, like a tool that has to get through
+				uint64_t start = readTsc();
+				std::exception_ptr applyError;
+				std::thread applier([&]() {
+					SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_ABOVE_NORMAL);
+					try
+					{
+						if (result.strategy == ApplyStrategy::SERIAL)
+						{
+							applySerial(writes);
+						}
+						else if (result.strategy == ApplyStrategy::PINNED)
+						{
+							pinnedWriters.apply();
+						}
+						else if (result.strategy == ApplyStrategy::BATCHED)
+						{
+							applyBatched(writes);
+						}
+					}
+					catch (...)
+					{
+						applyError = std::current_exception();
+					}
+				});
+				applier.join();
+				result.applyTicks.push_back(readTsc() - start);
+
+				Sleep(SETTLE_MS);
+				window = NO_WINDOW;
+
+				if (applyError)
+				{
+					std::rethrow_exception(applyError);
+				}
+			}
+
+			results.push_back(result);
+		}
+	}
+	catch (...)
+	{
+		stop = true;
+		for (std::thread& victim : victimThreads)
+		{
+			victim.join();
+		}
+		throw;
+	}
+
+	stop = true;
+	for (std::thread& victim : victimThreads)
+	{
+		victim.join();
+	}
+
+	// the victims are done, so the last window of every strategy is complete as well
+	for (int s = 0; s < NUM_STRATEGIES; s++)
+	{
+		for (size_t v = 0; v < victims.size(); v++)
+		{
+			results[s].stallTicks.emplace_back(longest[v].begin() + s * repetitions, longest[v].begin() + (s + 1) * repetitions);
+		}
+	}
+
+	return results;
+}
+
+void printDisturbanceReport(const std::vector<DisturbanceResult>& results, double tscHz)
+{
+	if (results.empty())
+	{
+		return;
+	}
+
+	double ticksToUs = 1e6 / tscHz;
+	std::streamsize precision = std::cout.precision();
+
+	std::cout << "Apply duration (median / max, us):" << std::endl;
+	std::cout << std::fixed << std::setprecision(1);
+	for (const DisturbanceResult& result : results)
+	{
+		if (result.strategy == ApplyStrategy::NONE)
+		{
+			continue;
+		}
+
+		Distribution duration = summarize(result.applyTicks, ticksToUs);
+		std::cout << "  " << std::left << std::setw(10) << formatApplyStrategy(result.strategy) << std::right
+			<< std::setw(10) << duration.median << " / " << duration.max << std::endl;
+	}
+
+	std::cout << "\nLongest iteration of the victim loop per apply (p99 / max, us):\n" << std::left << std::setw(8) << "Thread";
+	for (const DisturbanceResult& result : results)
+	{
+		std::cout << std::setw(20) << formatApplyStrategy(result.strategy);
+	}
+	std::cout << std::endl;
+
+	for (size_t v = 0; v < results.front().threads.size(); v++)
+	{
+		std::cout << std::setw(8) << results.front().threads[v];
+		for (const DisturbanceResult& result : results)
+		{
+			Distribution stall = summarize(result.stallTicks[v], ticksToUs);
+			std::ostringstream cell;
+			cell << std::fixed << std::setprecision(1) << stall.p99 << " / " << stall.max;
+			std::cout << std::setw(20) << cell.str();
+		}
+		std::cout << std::endl;
+	}
+
+	std::cout << std::defaultfloat << std::setprecision(precision) << std::right;
+}
+
+static std::vector<std::vector<RegisterWrite>> planWrites(int pstate, int numThreads)
+{
+	std::vector<std::vector<RegisterWrite>> writes(numThreads);
+	std::vector<uint64_t> definitions = readMsrOnAllThreads(PowerState::getRegister(pstate), numThreads);
+
+	for (int thread = 0; thread < numThreads; thread++)
+	{
+		// a pstate 0 change locks the TSC first, the HWCR value is written back unchanged
+		if (pstate == 0)
+		{
+			writes[thread].push_back({ HWCONF_REGISTER, readMsr(HWCONF_REGISTER, (DWORD_PTR)1 << thread) });
+		}
+		writes[thread].push_back({ PowerState::getRegister(pstate), definitions[thread] });
+	}
+
+	return writes;
+}
+
+static void writeOnCurrentThread(const std::vector<RegisterWrite>& writes)
+{
+	for (const RegisterWrite& write : writes)
+	{
+		if (!Wrmsr(write.reg, (DWORD)write.value, (DWORD)(write.value >> 32)))
+		{
+			std::ostringstream errorMessage;
+			errorMessage << "Failed to write MSR 0x" << std::hex << std::uppercase << write.reg;
+			throw std::runtime_error(errorMessage.str());
+		}
+	}
+}
+
+static void applySerial(const std::vector<std::vector<RegisterWrite>>& writes)
+{
+	// like applyPstate: first HWCR on every thread, then the definition on every thread
+	size_t numRegisters = writes.empty() ? 0 : writes.front().size();
+	for (size_t i = 0; i < numRegisters; i++)
+	{
+		for (int thread = 0; thread < (int)writes.size(); thread++)
+		{
+			writeMsr(writes[thread][i].reg, writes[thread][i].value, (DWORD_PTR)1 << thread);
+		}
+	}
+}
+
+static void applyBatched(const std::vector<std::vector<RegisterWrite>>& writes)
+{
+	// runs on its own thread, so moving between the hardware threads doesn't affect the caller
+	for (int thread = 0; thread < (int)writes.size(); thread++)
+	{
+		pinCurrentThread(thread);
+		writeOnCurrentThread(writes[thread]);
+	}
+}
@@ -0,0 +1,33 @@
+﻿#pragma once
+#include <string>
+#include <vector>
+
+#include <Windows.h>
+
+// how the register writes of an apply reach every hardware thread
+enum class ApplyStrategy
+{
+	NONE, // no writes, the background noise of the victims
+	SERIAL, // one thread writes register by register, every write hops to the target thread (WrmsrTx)
+	PINNED, // one worker pinned to every thread writes its own registers, all in parallel
+	BATCHED // one thread visits every hardware thread once and writes all of its registers there
+};
+
+const char* formatApplyStrategy(ApplyStrategy strategy);
+
+struct DisturbanceResult
+{
+	ApplyStrategy strategy{ ApplyStrategy::NONE };
+	std::vector<int> threads; // victim threads
+	std::vector<std::vector<uint64_t>> stallTicks; // [victim][repetition] longest iteration during the apply
+	std::vector<uint64_t> applyTicks; // [repetition] duration of the apply
+};
+
+// runs a latency sensitive loop on every victim thread and applies the current definition of the
+// pstate again with every strategy, repetitions times each. the same values are written back, so
+// nothing changes, but the writes take the same path as applyPstate, including the read-modify-write
+// of HWCR for pstate 0 (lockTsc). for every apply, the longest iteration of every victim is its stall
+std::vector<DisturbanceResult> measureApplyDisturbance(DWORD_PTR victimMask, int pstate, int repetitions, int numThreads);
+
+// p99 and max stall per victim thread and strategy, and the apply duration per strategy
+void printDisturbanceReport(const std::vector<DisturbanceResult>& results, double tscHz);
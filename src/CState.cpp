@@ -0,0 +1,69 @@
+﻿#include "CState.h"
+
+#include <iostream>
+
+#include "Msr.h"
+#include "Threads.h"
+
+// constants
+static constexpr unsigned int PMGT_MISC_REGISTER{ 0xC0010292 };
+static constexpr unsigned int CSTATE_CONFIG_REGISTER{ 0xC0010296 };
+
+// PMGT_MISC[32] PC6En
+static constexpr uint64_t PC6_ENABLE_BITS{ (uint64_t)1 << 32 };
+
+// CStateConfig[22] CCR2_CC6EN, [14] CCR1_CC6EN, [6] CCR0_CC6EN
+static constexpr uint64_t CC6_ENABLE_BITS{ (1 << 22) | (1 << 14) | (1 << 6) };
+
+// prototypes
+static DWORD_PTR getFirstThreadMask(DWORD_PTR mask);
+static void updateBits(unsigned int reg, uint64_t bits, bool enabled, DWORD_PTR mask);
+
+CStateConfig readCStateConfig(DWORD_PTR mask)
+{
+	DWORD_PTR firstThread = getFirstThreadMask(mask);
+
+	CStateConfig config;
+	config.cc6Enabled = (readMsr(CSTATE_CONFIG_REGISTER, firstThread) & CC6_ENABLE_BITS) == CC6_ENABLE_BITS;
+	config.pc6Enabled = (readMsr(PMGT_MISC_REGISTER, firstThread) & PC6_ENABLE_BITS) != 0;
+
+	return config;
+}
+
+void setCc6Enabled(bool enabled, DWORD_PTR mask)
+{
+	updateBits(CSTATE_CONFIG_REGISTER, CC6_ENABLE_BITS, enabled, mask);
+}
+
+void setPc6Enabled(bool enabled, DWORD_PTR mask)
+{
+	updateBits(PMGT_MISC_REGISTER, PC6_ENABLE_BITS, enabled, mask);
+}
+
+void printCStateConfig(DWORD_PTR mask)
+{
+	for (int thread : getThreadsInMask(mask))
+	{
+		CStateConfig config = readCStateConfig((DWORD_PTR)1 << thread);
+		std::cout << "Thread " << thread
+			<< ": CC6 " << (config.cc6Enabled ? "enabled" : "disabled")
+			<< ", PC6 " << (config.pc6Enabled ? "enabled" : "disabled") << std::endl;
+	}
+}
+
+static DWORD_PTR getFirstThreadMask(DWORD_PTR mask)
+{
+	// isolate the lowest set bit
+	return mask & (~mask + 1);
+}
+
+static void updateBits(unsigned int reg, uint64_t bits, bool enabled, DWORD_PTR mask)
+{
+	for (int thread : getThreadsInMask(mask))
+	{
+		DWORD_PTR threadMask = (DWORD_PTR)1 << thread;
+		uint64_t value = readMsr(reg, threadMask);
+		value = enabled ? value | bits : value & ~bits;
+		writeMsr(reg, value, threadMask);
+	}
+}
@@ -0,0 +1,20 @@
+﻿#pragma once
+#include <Windows.h>
+
+struct CStateConfig
+{
+	bool cc6Enabled{ false };
+	bool pc6Enabled{ false };
+};
+
+// reads core C6 and package C6 enablement on the first thread selected by the mask
+CStateConfig readCStateConfig(DWORD_PTR mask);
+
+// core C6 is configured per core, so every thread of the selected cores is written
+void setCc6Enabled(bool enabled, DWORD_PTR mask);
+
+// package C6 is a package wide setting, but the register is written on every selected thread
+// like the pstate definitions to avoid depending on which thread the firmware reads it from
+void setPc6Enabled(bool enabled, DWORD_PTR mask);
+
+void printCStateConfig(DWORD_PTR mask);
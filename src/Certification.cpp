@@ -0,0 +1,289 @@
+﻿#include "Certification.h"
+
+#include <algorithm>
+#include <ctime>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include "CpuStatus.h"
+#include "Cpuid.h"
+#include "Msr.h"
+#include "Smn.h"
+#include "Stress.h"
+#include "Threads.h"
+#include "Trace.h"
+
+// constants
+static constexpr unsigned int PATCH_LEVEL_REGISTER{ 0x0000008B };
+static constexpr unsigned int PPIN_CONTROL_REGISTER{ 0xC00102F0 };
+static constexpr unsigned int PPIN_REGISTER{ 0xC00102F1 };
+static constexpr char DEFAULT_DATABASE_NAME[]{ "ryzen_pstates_certified.txt" };
+static constexpr char STRESS_NAME[]{ "integer" };
+static constexpr DWORD TEMPERATURE_INTERVAL_MS{ 250 };
+
+// prototypes
+static bool parseRecord(const std::string& line, CertificationRecord& record);
+static std::string formatRecord(const CertificationRecord& record);
+static bool isSameChip(const CpuIdentity& a, const CpuIdentity& b);
+
+CpuIdentity readCpuIdentity()
+{
+	CpuIdentity identity;
+	identity.signature = getCpuSignature();
+	identity.microcode = (uint32_t)readMsr(PATCH_LEVEL_REGISTER, 0x1);
+
+	try
+	{
+		// PPIN_CTL[1] PPIN_EN, the BIOS decides whether the number is readable
+		if (readMsr(PPIN_CONTROL_REGISTER, 0x1) & 0x2)
+		{
+			identity.chipId = readMsr(PPIN_REGISTER, 0x1);
+		}
+	}
+	catch (const std::runtime_error&)
+	{
+		// not every Zen part implements the PPIN
+	}
+
+	return identity;
+}
+
+std::string getDefaultCertificationDatabasePath()
+{
+	char path[MAX_PATH];
+	DWORD length = GetModuleFileNameA(nullptr, path, MAX_PATH);
+	if (!length || length == MAX_PATH)
+	{
+		return DEFAULT_DATABASE_NAME;
+	}
+
+	std::string directory(path, length);
+	size_t separator = directory.find_last_of("\\/");
+	if (separator == std::string::npos)
+	{
+		return DEFAULT_DATABASE_NAME;
+	}
+
+	return directory.substr(0, separator + 1) + DEFAULT_DATABASE_NAME;
+}
+
+CertificationDatabase::CertificationDatabase(const std::string& path, const CpuIdentity& identity)
+	:path(path), identity(identity)
+{
+	std::ifstream file(path);
+	std::string line;
+
+	while (std::getline(file, line))
+	{
+		CertificationRecord record;
+		if (line.empty() || line[0] == '#' || !parseRecord(line, record))
+		{
+			continue;
+		}
+
+		if (isSameChip(record.identity, identity))
+		{
+			records.push_back(record);
+		}
+	}
+}
+
+const CertificationRecord* CertificationDatabase::find(const PowerState& powerState) const
+{
+	auto latest = std::find_if(records.rbegin(), records.rend(), [&](const CertificationRecord& record) {
+		return record.pstate == powerState.getPstate() && record.fid == powerState.getFid()
+			&& record.did == powerState.getDid() && record.vid == powerState.getVid();
+	});
+
+	return latest == records.rend() ? nullptr : &*latest;
+}
+
+void CertificationDatabase::add(const CertificationRecord& record)
+{
+	// written through, the line must be on disk if the next thing that happens is a crash
+	HANDLE file = CreateFileA(path.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ, nullptr, OPEN_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_WRITE_THROUGH, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		throw std::runtime_error("Failed to open certification database '" + path + "'");
+	}
+
+	CertificationRecord stamped = record;
+	stamped.identity = identity;
+
+	std::string line = formatRecord(stamped) + "\n";
+	DWORD written;
+	BOOL success = WriteFile(file, line.data(), (DWORD)line.size(), &written, nullptr)
+		&& written == line.size() && FlushFileBuffers(file);
+	CloseHandle(file);
+
+	if (!success)
+	{
+		throw std::runtime_error("Failed to write certification database '" + path + "'");
+	}
+
+	records.push_back(stamped);
+}
+
+const CpuIdentity& CertificationDatabase::getIdentity() const
+{
+	return identity;
+}
+
+const std::vector<CertificationRecord>& CertificationDatabase::getRecords() const
+{
+	return records;
+}
+
+const char* formatCertificationResult(CertificationResult result)
+{
+	switch (result)
+	{
+	case CertificationResult::PASSED:
+		return "pass";
+	case CertificationResult::FAILED:
+		return "fail";
+	default:
+		return "incomplete";
+	}
+}
+
+void checkCertification(const CertificationDatabase& database, const PowerState& powerState, bool force)
+{
+	const CertificationRecord* record = database.find(powerState);
+	if (!record)
+	{
+		std::cout << "Certification: not tested on this CPU" << std::endl;
+		return;
+	}
+
+	std::time_t time = (std::time_t)record->timestamp;
+	std::cout << "Certification: " << formatCertificationResult(record->result) << " (" << record->stress
+		<< " stress, " << record->durationMs / 1000.0 << " s, " << record->minTemperature << " - "
+		<< record->maxTemperature << " C, " << std::put_time(std::localtime(&time), "%Y-%m-%d %H:%M") << ")" << std::endl;
+
+	if (record->result != CertificationResult::PASSED && !force)
+	{
+		throw std::runtime_error("This pstate definition is known to be unstable on this CPU, use --force to apply it anyway");
+	}
+}
+
+CertificationRecord makeCertificationRecord(const PowerState& powerState, DWORD durationMs)
+{
+	CertificationRecord record;
+	record.pstate = powerState.getPstate();
+	record.fid = powerState.getFid();
+	record.did = powerState.getDid();
+	record.vid = powerState.getVid();
+	record.stress = STRESS_NAME;
+	record.durationMs = durationMs;
+	record.timestamp = (int64_t)std::time(nullptr);
+	return record;
+}
+
+CertificationRecord runCertificationStress(const PowerState& powerState, DWORD durationMs, int numThreads)
+{
+	TraceSpan span("runCertificationStress", "pstate", powerState.getPstate());
+
+	CertificationRecord record = makeCertificationRecord(powerState, durationMs);
+
+	PciSmnAccess smn;
+	DWORD_PTR allThreadsMask = getAllThreadsMask(numThreads);
+
+	std::vector<int> originalControl;
+	for (int thread = 0; thread < numThreads; thread++)
+	{
+		originalControl.push_back(readPstateControl((DWORD_PTR)1 << thread));
+	}
+
+	bool stable = false;
+	std::exception_ptr error;
+	try
+	{
+		// the request is per thread, a multi thread mask would only reach one of them. the OS can
+		// override it at any time, pstates other than 0 are only held reliably with a power plan
+		// that caps the processor state
+		for (int thread = 0; thread < numThreads; thread++)
+		{
+			writePstateControl(powerState.getPstate(), (DWORD_PTR)1 << thread);
+		}
+
+		record.minTemperature = record.maxTemperature = readTemperature(smn);
+
+		Stress stress(allThreadsMask, durationMs);
+		while (!stress.wait(TEMPERATURE_INTERVAL_MS))
+		{
+			double temperature = readTemperature(smn);
+			record.minTemperature = std::min(record.minTemperature, temperature);
+			record.maxTemperature = std::max(record.maxTemperature, temperature);
+		}
+		stable = stress.isStable();
+	}
+	catch (...)
+	{
+		error = std::current_exception();
+	}
+
+	for (int thread = 0; thread < numThreads; thread++)
+	{
+		writePstateControl(originalControl[thread], (DWORD_PTR)1 << thread);
+	}
+
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
+
+	record.result = stable ? CertificationResult::PASSED : CertificationResult::FAILED;
+	return record;
+}
+
+// signature microcode chipId pstate fid did vid stress durationMs result minTemperature maxTemperature timestamp
+static bool parseRecord(const std::string& line, CertificationRecord& record)
+{
+	std::istringstream lineStream(line);
+	std::string result;
+
+	lineStream >> std::hex >> record.identity.signature >> record.identity.microcode >> record.identity.chipId
+		>> std::dec >> record.pstate >> record.fid >> record.did >> record.vid >> record.stress >> record.durationMs
+		>> result >> record.minTemperature >> record.maxTemperature >> record.timestamp;
+
+	if (!lineStream)
+	{
+		return false;
+	}
+
+	if (result == "pass")
+	{
+		record.result = CertificationResult::PASSED;
+	}
+	else if (result == "fail")
+	{
+		record.result = CertificationResult::FAILED;
+	}
+	else
+	{
+		record.result = CertificationResult::INCOMPLETE;
+	}
+
+	return true;
+}
+
+static std::string formatRecord(const CertificationRecord& record)
+{
+	std::ostringstream line;
+	line << std::hex << record.identity.signature << ' ' << record.identity.microcode << ' ' << record.identity.chipId
+		<< std::dec << ' ' << record.pstate << ' ' << record.fid << ' ' << record.did << ' ' << record.vid
+		<< ' ' << record.stress << ' ' << record.durationMs << ' ' << formatCertificationResult(record.result)
+		<< ' ' << record.minTemperature << ' ' << record.maxTemperature << ' ' << record.timestamp;
+	return line.str();
+}
+
+static bool isSameChip(const CpuIdentity& a, const CpuIdentity& b)
+{
+	return a.signature == b.signature && a.microcode == b.microcode && a.chipId == b.chipId;
+}
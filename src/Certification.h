@@ -0,0 +1,80 @@
+﻿#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <Windows.h>
+
+#include "PowerState.h"
+
+// identifies the chip a certification is valid for
+struct CpuIdentity
+{
+	uint32_t signature{ 0 }; // CPUID level 1 EAX
+	uint32_t microcode{ 0 }; // patch level
+	uint64_t chipId{ 0 }; // protected processor inventory number, 0 if not available
+};
+
+enum class CertificationResult
+{
+	PASSED,
+	FAILED,
+	INCOMPLETE // the stress never finished, the system most likely crashed
+};
+
+struct CertificationRecord
+{
+	CpuIdentity identity;
+	int pstate{ 0 };
+	unsigned int fid{ 0 };
+	unsigned int did{ 0 };
+	unsigned int vid{ 0 };
+	std::string stress;
+	DWORD durationMs{ 0 };
+	CertificationResult result{ CertificationResult::INCOMPLETE };
+	double minTemperature{ 0 };
+	double maxTemperature{ 0 };
+	int64_t timestamp{ 0 }; // seconds since the epoch
+};
+
+CpuIdentity readCpuIdentity();
+
+// the database next to the executable, used if no other path is given
+std::string getDefaultCertificationDatabasePath();
+
+// append only text file with one validated (pstate, fid, did, vid) point per line,
+// the latest record of a point is the one that counts
+class CertificationDatabase
+{
+public:
+	// loads the records of this cpu, a missing file is an empty database
+	CertificationDatabase(const std::string& path, const CpuIdentity& identity);
+
+	// latest record of the point on this cpu, nullptr if it was never tested
+	const CertificationRecord* find(const PowerState& powerState) const;
+
+	// stamps the record with our cpu identity and writes it through to disk before returning,
+	// so it survives a crash right after
+	void add(const CertificationRecord& record);
+
+	const CpuIdentity& getIdentity() const;
+	const std::vector<CertificationRecord>& getRecords() const;
+
+private:
+	std::string path;
+	CpuIdentity identity;
+	std::vector<CertificationRecord> records;
+};
+
+const char* formatCertificationResult(CertificationResult result);
+
+// prints the certification state of the point and throws if it is known to be unstable,
+// unless forced
+void checkCertification(const CertificationDatabase& database, const PowerState& powerState, bool force);
+
+// an incomplete record of the point, the result is filled in by the stress
+CertificationRecord makeCertificationRecord(const PowerState& powerState, DWORD durationMs);
+
+// requests the pstate on all threads with PStateCtl, runs the stress on all threads and records the
+// temperature range. the pstate definition itself must already be applied
+CertificationRecord runCertificationStress(const PowerState& powerState, DWORD durationMs, int numThreads);
@@ -0,0 +1,115 @@
+﻿#include "ChildProcess.h"
+
+#include <stdexcept>
+
+// prototypes
+static std::string quoteArgument(const std::string& arg);
+
+std::string buildCommandLine(const std::vector<std::string>& args)
+{
+	std::string commandLine;
+
+	for (const std::string& arg : args)
+	{
+		if (!commandLine.empty())
+		{
+			commandLine += ' ';
+		}
+		commandLine += quoteArgument(arg);
+	}
+
+	return commandLine;
+}
+
+ChildProcess::ChildProcess(const std::string& commandLine)
+	:processInfo()
+{
+	STARTUPINFOA startupInfo{};
+	startupInfo.cb = sizeof(startupInfo);
+
+	// CreateProcess may modify the command line buffer
+	std::vector<char> buffer(commandLine.begin(), commandLine.end());
+	buffer.push_back('\0');
+
+	if (!CreateProcessA(nullptr, buffer.data(), nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startupInfo, &processInfo))
+	{
+		throw std::runtime_error("Failed to start '" + commandLine + "' (error " + std::to_string(GetLastError()) + ")");
+	}
+}
+
+ChildProcess::~ChildProcess()
+{
+	CloseHandle(processInfo.hThread);
+	CloseHandle(processInfo.hProcess);
+}
+
+bool ChildProcess::wait(DWORD timeoutMs)
+{
+	DWORD result = WaitForSingleObject(processInfo.hProcess, timeoutMs);
+	if (result == WAIT_FAILED)
+	{
+		throw std::runtime_error("Failed to wait for process " + std::to_string(processInfo.dwProcessId));
+	}
+
+	return result == WAIT_OBJECT_0;
+}
+
+DWORD ChildProcess::getExitCode() const
+{
+	DWORD exitCode;
+	if (!GetExitCodeProcess(processInfo.hProcess, &exitCode))
+	{
+		throw std::runtime_error("Failed to get the exit code of process " + std::to_string(processInfo.dwProcessId));
+	}
+
+	return exitCode;
+}
+
+DWORD ChildProcess::getProcessId() const
+{
+	return processInfo.dwProcessId;
+}
+
+HANDLE ChildProcess::getHandle() const
+{
+	return processInfo.hProcess;
+}
+
+// follows the rules of CommandLineToArgvW: backslashes are only special in front of a quote
+static std::string quoteArgument(const std::string& arg)
+{
+	if (!arg.empty() && arg.find_first_of(" \t\"") == std::string::npos)
+	{
+		return arg;
+	}
+
+	std::string quoted = "\"";
+	size_t backslashes = 0;
+
+	for (char c : arg)
+	{
+		if (c == '\\')
+		{
+			backslashes++;
+			continue;
+		}
+
+		if (c == '"')
+		{
+			quoted.append(backslashes * 2 + 1, '\\');
+		}
+		else
+		{
+			quoted.append(backslashes, '\\');
+		}
+
+		quoted += c;
+		backslashes = 0;
+	}
+
+	// the closing quote must not be escaped by trailing backslashes
+	quoted.append(backslashes * 2, '\\');
+	quoted += '"';
+
+	return quoted;
+}
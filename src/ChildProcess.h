@@ -0,0 +1,31 @@
+﻿#pragma once
+#include <string>
+#include <vector>
+
+#include <Windows.h>
+
+// joins arguments into a windows command line, quoting them so the child's argv matches
+std::string buildCommandLine(const std::vector<std::string>& args);
+
+// a process started from a command line, it shares our console
+class ChildProcess
+{
+public:
+	explicit ChildProcess(const std::string& commandLine);
+
+	// the process keeps running if it is still alive, only the handles are closed
+	virtual ~ChildProcess();
+
+	ChildProcess(const ChildProcess&) = delete;
+	ChildProcess& operator=(const ChildProcess&) = delete;
+
+	// returns true once the process has exited, false if the timeout elapsed
+	bool wait(DWORD timeoutMs);
+
+	DWORD getExitCode() const;
+	DWORD getProcessId() const;
+	HANDLE getHandle() const;
+
+private:
+	PROCESS_INFORMATION processInfo;
+};
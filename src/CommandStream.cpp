@@ -0,0 +1,223 @@
+﻿#include "CommandStream.h"
+
+#include <sstream>
+#include <stdexcept>
+
+// prototypes
+static unsigned int parseNumber(const std::string& value, const std::string& name);
+static int parsePstate(const std::string& value);
+
+std::optional<StreamCommand> parseStreamCommand(const std::string& line)
+{
+	std::istringstream lineStream(line.substr(0, line.find('#')));
+	std::vector<std::string> tokens;
+	std::string token;
+	while (lineStream >> token)
+	{
+		tokens.push_back(token);
+	}
+
+	if (tokens.empty())
+	{
+		return std::nullopt;
+	}
+
+	StreamCommand command;
+	const std::string& verb = tokens[0];
+
+	if (verb == "read")
+	{
+		command.verb = StreamVerb::READ;
+		if (tokens.size() > 2)
+		{
+			throw std::invalid_argument("read takes at most one pstate");
+		}
+		if (tokens.size() == 2 && tokens[1] != "all")
+		{
+			command.pstate = parsePstate(tokens[1]);
+		}
+	}
+	else if (verb == "set")
+	{
+		command.verb = StreamVerb::SET;
+		if (tokens.size() < 3)
+		{
+			throw std::invalid_argument("set needs a pstate and at least one of fid=, did= and vid=");
+		}
+
+		command.edit.pstate = parsePstate(tokens[1]);
+		for (size_t i = 2; i < tokens.size(); i++)
+		{
+			size_t separator = tokens[i].find('=');
+			std::string name = tokens[i].substr(0, separator);
+			if (separator == std::string::npos)
+			{
+				throw std::invalid_argument("Field '" + tokens[i] + "' must have the form name=value");
+			}
+
+			unsigned int value = parseNumber(tokens[i].substr(separator + 1), name);
+			if (name == "fid")
+			{
+				command.edit.fid = value;
+			}
+			else if (name == "did")
+			{
+				command.edit.did = value;
+			}
+			else if (name == "vid")
+			{
+				command.edit.vid = value;
+			}
+			else
+			{
+				throw std::invalid_argument("Unknown field '" + name + "'");
+			}
+		}
+	}
+	else if (verb == "apply")
+	{
+		command.verb = StreamVerb::APPLY;
+		if (tokens.size() > 2 || (tokens.size() == 2 && tokens[1] != "force"))
+		{
+			throw std::invalid_argument("apply only takes 'force'");
+		}
+		command.force = tokens.size() == 2;
+	}
+	else if (verb == "discard" || verb == "verify" || verb == "quit")
+	{
+		command.verb = verb == "discard" ? StreamVerb::DISCARD : verb == "verify" ? StreamVerb::VERIFY : StreamVerb::QUIT;
+		if (tokens.size() > 1)
+		{
+			throw std::invalid_argument(verb + " takes no arguments");
+		}
+	}
+	else if (verb == "sample")
+	{
+		command.verb = StreamVerb::SAMPLE;
+		if (tokens.size() > 2)
+		{
+			throw std::invalid_argument("sample takes at most an interval in ms");
+		}
+		if (tokens.size() == 2)
+		{
+			command.sampleMs = parseNumber(tokens[1], "interval");
+		}
+	}
+	else
+	{
+		throw std::invalid_argument("Unknown command '" + verb + "'");
+	}
+
+	return command;
+}
+
+const PowerState& StagedEdits::stage(const PstateEdit& edit)
+{
+	auto it = staged.find(edit.pstate);
+	if (it == staged.end())
+	{
+		return staged.emplace(edit.pstate, resolveEdit(edit)).first->second;
+	}
+
+	// the edit must not be half applied if a field is out of bounds
+	PowerState powerState = it->second;
+	if (edit.fid)
+	{
+		powerState.setFid(*edit.fid);
+	}
+	if (edit.did)
+	{
+		powerState.setDid(*edit.did);
+	}
+	if (edit.vid)
+	{
+		powerState.setVid(*edit.vid);
+	}
+
+	it->second = powerState;
+	return it->second;
+}
+
+std::vector<PowerState> StagedEdits::getStaged() const
+{
+	std::vector<PowerState> powerStates;
+	for (const auto& entry : staged)
+	{
+		powerStates.push_back(entry.second);
+	}
+	return powerStates;
+}
+
+void StagedEdits::clear()
+{
+	staged.clear();
+}
+
+size_t StagedEdits::size() const
+{
+	return staged.size();
+}
+
+std::string formatPowerStateFields(const PowerState& powerState)
+{
+	std::ostringstream fields;
+	fields << "pstate=" << powerState.getPstate() << " enabled=" << (powerState.getValue() >> 63 & 0x1)
+		<< " fid=" << +powerState.getFid() << " did=" << +powerState.getDid() << " vid=" << +powerState.getVid()
+		<< " mhz=" << powerState.calculateFrequency() << " vcore=" << powerState.calculateVcore();
+	return fields.str();
+}
+
+std::string quoteStreamValue(const std::string& value)
+{
+	std::string quoted = "\"";
+	for (char c : value)
+	{
+		if (c == '"' || c == '\\')
+		{
+			quoted += '\\';
+		}
+		quoted += c == '\n' ? ' ' : c;
+	}
+	return quoted + "\"";
+}
+
+DiagnosticsToStderr::DiagnosticsToStderr()
+	:original(std::cout.rdbuf(std::cerr.rdbuf()))
+{
+}
+
+DiagnosticsToStderr::~DiagnosticsToStderr()
+{
+	std::cout.rdbuf(original);
+}
+
+static unsigned int parseNumber(const std::string& value, const std::string& name)
+{
+	size_t end = 0;
+	unsigned long number = 0;
+	try
+	{
+		number = std::stoul(value, &end, 0);
+	}
+	catch (const std::exception&)
+	{
+		end = 0;
+	}
+
+	if (value.empty() || end != value.size() || value[0] == '-')
+	{
+		throw std::invalid_argument("Value of " + name + " must be a number, got '" + value + "'");
+	}
+
+	return (unsigned int)number;
+}
+
+static int parsePstate(const std::string& value)
+{
+	unsigned int pstate = parseNumber(value, "pstate");
+	if (pstate > 7)
+	{
+		throw std::invalid_argument("Pstate must be between 0 and 7");
+	}
+	return (int)pstate;
+}
@@ -0,0 +1,85 @@
+﻿#pragma once
+#include <iostream>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <Windows.h>
+
+#include "PowerState.h"
+#include "Profile.h"
+
+// a command stream has one command per line, '#' starts a comment:
+//   read [pstate|all]               current definition of one or all pstates
+//   set pstate fid=.. did=.. vid=.. stages an edit, fields that are not given keep their value
+//   apply [force]                   writes all staged edits
+//   discard                         drops all staged edits
+//   verify                          checks that all threads agree on every pstate and the TSC
+//   sample [ms]                     frequency, pstate and power of every thread over the interval
+//   quit
+// every response line starts with "ok <command>" or "error", followed by key=value pairs
+
+enum class StreamVerb
+{
+	READ,
+	SET,
+	APPLY,
+	DISCARD,
+	VERIFY,
+	SAMPLE,
+	QUIT
+};
+
+static constexpr DWORD STREAM_DEFAULT_SAMPLE_MS{ 1000 };
+
+struct StreamCommand
+{
+	StreamVerb verb{ StreamVerb::READ };
+	std::optional<int> pstate; // read: all pstates if not set
+	PstateEdit edit; // set
+	bool force{ false }; // apply: even if the definition is known to be unstable
+	DWORD sampleMs{ STREAM_DEFAULT_SAMPLE_MS };
+};
+
+// nothing for blank lines and comments
+std::optional<StreamCommand> parseStreamCommand(const std::string& line);
+
+// edits wait here until the next apply. a later edit of the same pstate changes the staged
+// definition, so any number of edits ends up as one write per register and thread
+class StagedEdits
+{
+public:
+	// applies the edit to the staged definition of its pstate, or to the current one
+	const PowerState& stage(const PstateEdit& edit);
+
+	// ascending by pstate
+	std::vector<PowerState> getStaged() const;
+
+	void clear();
+	size_t size() const;
+
+private:
+	std::map<int, PowerState> staged;
+};
+
+// "pstate=0 enabled=1 fid=136 did=8 vid=80 mhz=3400 vcore=1.1"
+std::string formatPowerStateFields(const PowerState& powerState);
+
+// quoted, so a value with spaces stays one key=value pair
+std::string quoteStreamValue(const std::string& value);
+
+// sends everything written to stdout to stderr while it lives, so the human readable output of
+// shared code doesn't mix with the responses
+class DiagnosticsToStderr
+{
+public:
+	DiagnosticsToStderr();
+	virtual ~DiagnosticsToStderr();
+
+	DiagnosticsToStderr(const DiagnosticsToStderr&) = delete;
+	DiagnosticsToStderr& operator=(const DiagnosticsToStderr&) = delete;
+
+private:
+	std::streambuf* original;
+};
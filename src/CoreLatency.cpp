@@ -0,0 +1,267 @@
+﻿#include "CoreLatency.h"
+
+#include <atomic>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+#include "CpuStatus.h"
+#include "Profile.h"
+#include "Statistics.h"
+#include "Threads.h"
+#include "Trace.h"
+#include "Tsc.h"
+
+// constants
+// the first round trips include the thread start and the cache line still being in its initial state
+static constexpr int WARMUP_ROUND_TRIPS{ 100 };
+
+// the line bounced between the threads, nothing else may share its cache line
+struct alignas(64) PingPongLine
+{
+	std::atomic<uint64_t> value{ 0 };
+};
+
+// prototypes
+static const CoreInfo& findCore(const std::vector<CoreInfo>& cores, int thread);
+static void restorePstateControl(const std::vector<int>& control);
+
+std::vector<int> parsePstateList(const std::string& pstateList)
+{
+	// same syntax as a thread list, just with the 8 pstates
+	try
+	{
+		return getThreadsInMask(parseThreadMask(pstateList, 8));
+	}
+	catch (const std::invalid_argument&)
+	{
+		throw std::invalid_argument("Invalid pstate list '" + pstateList + "' (pstates are between 0 and 7)");
+	}
+}
+
+double measureRoundTrip(int initiatorThread, int responderThread, int iterations, double tscHz)
+{
+	TraceSpan span("measureRoundTrip", "thread", responderThread);
+	PingPongLine line;
+	std::atomic<bool> aborted{ false };
+	std::exception_ptr error;
+	std::vector<uint64_t> samples(iterations);
+
+	// both sides run on their own pinned thread, so the affinity of the caller is left alone
+	auto pinOrAbort = [&](int target) {
+		try
+		{
+			pinCurrentThread(target);
+			return true;
+		}
+		catch (...)
+		{
+			if (!aborted.exchange(true))
+			{
+				error = std::current_exception();
+			}
+			return false;
+		}
+	};
+
+	// odd values are pings from the initiator, even values the pongs of the responder
+	std::thread responder([&]() {
+		if (!pinOrAbort(responderThread))
+		{
+			return;
+		}
+
+		for (uint64_t i = 0; i < (uint64_t)(WARMUP_ROUND_TRIPS + iterations) && !aborted; i++)
+		{
+			while (line.value.load(std::memory_order_acquire) != 2 * i + 1 && !aborted)
+			{
+			}
+			line.value.store(2 * i + 2, std::memory_order_release);
+		}
+	});
+
+	std::thread initiator([&]() {
+		if (!pinOrAbort(initiatorThread))
+		{
+			return;
+		}
+
+		for (uint64_t i = 0; i < (uint64_t)(WARMUP_ROUND_TRIPS + iterations) && !aborted; i++)
+		{
+			uint64_t start = readTsc();
+			line.value.store(2 * i + 1, std::memory_order_release);
+
+			while (line.value.load(std::memory_order_acquire) != 2 * i + 2 && !aborted)
+			{
+			}
+
+			if (i >= WARMUP_ROUND_TRIPS)
+			{
+				samples[i - WARMUP_ROUND_TRIPS] = readTsc() - start;
+			}
+		}
+	});
+
+	initiator.join();
+	responder.join();
+
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
+
+	return summarize(samples, 1e9 / tscHz).median;
+}
+
+std::vector<LatencyMatrix> measureLatencyMatrices(DWORD_PTR mask, const std::vector<int>& pstates, int iterations, int numThreads)
+{
+	TraceSpan span("measureLatencyMatrices", "mask", mask);
+
+	std::vector<int> threads = getThreadsInMask(mask);
+	if (threads.size() < 2)
+	{
+		throw std::invalid_argument("At least two threads are needed for a latency matrix");
+	}
+
+	// fails for disabled pstates, before anything is changed
+	for (int pstate : pstates)
+	{
+		readPowerState(pstate);
+	}
+
+	double tscHz = calibrateTscFrequency();
+
+	// a core runs at the fastest pstate requested by any of its threads, so all of them are set
+	std::vector<int> originalControl;
+	for (int thread = 0; thread < numThreads; thread++)
+	{
+		originalControl.push_back(readPstateControl((DWORD_PTR)1 << thread));
+	}
+
+	std::vector<LatencyMatrix> matrices;
+
+	try
+	{
+		for (int pstate : pstates)
+		{
+			TraceSpan pstateSpan("latencyMatrix", "pstate", pstate);
+			for (int thread = 0; thread < numThreads; thread++)
+			{
+				writePstateControl(pstate, (DWORD_PTR)1 << thread);
+			}
+
+			LatencyMatrix matrix;
+			matrix.pstate = pstate;
+			matrix.threads = threads;
+			matrix.roundTripNs.assign(threads.size(), std::vector<double>(threads.size(), 0));
+
+			for (size_t i = 0; i < threads.size(); i++)
+			{
+				for (size_t j = i + 1; j < threads.size(); j++)
+				{
+					double roundTrip = measureRoundTrip(threads[i], threads[j], iterations, tscHz);
+					matrix.roundTripNs[i][j] = roundTrip;
+					matrix.roundTripNs[j][i] = roundTrip;
+
+					// the OS may request a different pstate at any time, we can only detect it
+					if (readCurrentPstate((DWORD_PTR)1 << threads[i]) != pstate
+						|| readCurrentPstate((DWORD_PTR)1 << threads[j]) != pstate)
+					{
+						matrix.pstateMismatches++;
+					}
+				}
+			}
+
+			matrices.push_back(matrix);
+		}
+	}
+	catch (const std::exception&)
+	{
+		restorePstateControl(originalControl);
+		throw;
+	}
+
+	restorePstateControl(originalControl);
+
+	return matrices;
+}
+
+void printLatencyMatrix(const LatencyMatrix& matrix, const std::vector<CoreInfo>& cores)
+{
+	PowerState powerState = readPowerState(matrix.pstate);
+	std::cout << "Round trip latency in ns at pstate " << matrix.pstate
+		<< " (" << powerState.calculateFrequency() << " MHz)" << std::endl;
+
+	std::cout << std::setw(5) << "";
+	for (int thread : matrix.threads)
+	{
+		std::cout << std::setw(6) << thread;
+	}
+	std::cout << std::endl;
+
+	enum { SMT, INTRA_CCX, CROSS_CCX, NUM_KINDS };
+	double sums[NUM_KINDS]{};
+	int counts[NUM_KINDS]{};
+
+	for (size_t i = 0; i < matrix.threads.size(); i++)
+	{
+		std::cout << std::setw(5) << matrix.threads[i];
+
+		for (size_t j = 0; j < matrix.threads.size(); j++)
+		{
+			if (i == j)
+			{
+				std::cout << std::setw(6) << "-";
+				continue;
+			}
+
+			std::cout << std::setw(6) << std::fixed << std::setprecision(0) << matrix.roundTripNs[i][j] << std::defaultfloat;
+
+			const CoreInfo& a = findCore(cores, matrix.threads[i]);
+			const CoreInfo& b = findCore(cores, matrix.threads[j]);
+			int kind = a.core == b.core ? SMT : (a.ccx == b.ccx ? INTRA_CCX : CROSS_CCX);
+			sums[kind] += matrix.roundTripNs[i][j];
+			counts[kind]++;
+		}
+
+		std::cout << std::endl;
+	}
+
+	const char* names[NUM_KINDS]{ "SMT siblings", "Same CCX", "Cross CCX" };
+	for (int kind = SMT; kind <= CROSS_CCX; kind++)
+	{
+		if (counts[kind])
+		{
+			std::cout << names[kind] << " average (ns): " << std::fixed << std::setprecision(1)
+				<< sums[kind] / counts[kind] << std::defaultfloat << std::endl;
+		}
+	}
+
+	if (counts[INTRA_CCX] && counts[CROSS_CCX])
+	{
+		std::cout << "Cross CCX / same CCX ratio: " << std::fixed << std::setprecision(2)
+			<< (sums[CROSS_CCX] / counts[CROSS_CCX]) / (sums[INTRA_CCX] / counts[INTRA_CCX]) << std::defaultfloat << std::endl;
+	}
+
+	if (matrix.pstateMismatches)
+	{
+		std::cout << "Warning: " << matrix.pstateMismatches << " pair(s) weren't running in pstate " << matrix.pstate
+			<< " after the measurement, the OS probably requested another pstate. "
+			"Set the minimum and maximum processor state of the power plan to the same value" << std::endl;
+	}
+}
+
+static const CoreInfo& findCore(const std::vector<CoreInfo>& cores, int thread)
+{
+	return cores[getCoreOfThread(cores, thread)];
+}
+
+static void restorePstateControl(const std::vector<int>& control)
+{
+	for (size_t thread = 0; thread < control.size(); thread++)
+	{
+		writePstateControl(control[thread], (DWORD_PTR)1 << thread);
+	}
+}
@@ -0,0 +1,28 @@
+﻿#pragma once
+#include <string>
+#include <vector>
+
+#include <Windows.h>
+
+#include "Topology.h"
+
+struct LatencyMatrix
+{
+	int pstate{ 0 };
+	std::vector<int> threads;
+	std::vector<std::vector<double>> roundTripNs; // indexed like threads, zero on the diagonal
+	int pstateMismatches{ 0 }; // pairs where a thread wasn't running in the requested pstate afterwards
+};
+
+// parses a pstate list like "0,2" or "0-2"
+std::vector<int> parsePstateList(const std::string& pstateList);
+
+// bounces a cache line between two pinned threads with atomics and returns the median round trip in ns
+double measureRoundTrip(int initiatorThread, int responderThread, int iterations, double tscHz);
+
+// requests each pstate on all threads with PStateCtl and measures the round trip of every pair of
+// threads in the mask. the requested pstates are restored afterwards
+std::vector<LatencyMatrix> measureLatencyMatrices(DWORD_PTR mask, const std::vector<int>& pstates, int iterations, int numThreads);
+
+// prints the matrix and the average latency between SMT siblings, within a CCX and across CCXs
+void printLatencyMatrix(const LatencyMatrix& matrix, const std::vector<CoreInfo>& cores);
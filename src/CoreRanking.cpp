@@ -0,0 +1,164 @@
+﻿#include "CoreRanking.h"
+
+#include <algorithm>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+#include "CpuStatus.h"
+#include "Msr.h"
+#include "Stress.h"
+#include "Threads.h"
+#include "Topology.h"
+#include "Trace.h"
+#include "Tsc.h"
+
+// constants
+static constexpr unsigned int CPPC_CAPABILITY_REGISTER{ 0xC00102B0 };
+
+// prototypes
+static bool readCppcCapability(CoreRank& rank);
+static void stressCore(CoreRank& rank, DWORD durationMs, double tscHz);
+
+std::vector<CoreRank> rankCores(int numThreads, DWORD stressDurationMs)
+{
+	TraceSpan span("rankCores");
+
+	std::vector<CoreRank> ranking;
+	bool cppcAvailable = true;
+
+	for (const CoreInfo& core : getCores(numThreads))
+	{
+		CoreRank rank;
+		rank.core = core.core;
+		rank.ccx = core.ccx;
+		rank.threadMask = core.threadMask;
+		cppcAvailable = cppcAvailable && readCppcCapability(rank);
+		ranking.push_back(rank);
+	}
+
+	if (!cppcAvailable && !stressDurationMs)
+	{
+		throw std::runtime_error("CPPC is not available on this CPU, use --stress to rank by measurement");
+	}
+
+	if (stressDurationMs)
+	{
+		double tscHz = calibrateTscFrequency();
+		for (CoreRank& rank : ranking)
+		{
+			stressCore(rank, stressDurationMs, tscHz);
+		}
+	}
+
+	// unstable cores go last, then by CPPC rating and measured frequency
+	std::stable_sort(ranking.begin(), ranking.end(), [](const CoreRank& a, const CoreRank& b) {
+		if (a.stable != b.stable)
+		{
+			return a.stable;
+		}
+		if (a.highestPerf != b.highestPerf)
+		{
+			return a.highestPerf > b.highestPerf;
+		}
+		return a.measuredMhz > b.measuredMhz;
+	});
+
+	return ranking;
+}
+
+void printCoreRanking(const std::vector<CoreRank>& ranking)
+{
+	std::cout << std::left << std::setw(6) << "Rank"
+		<< std::setw(6) << "Core"
+		<< std::setw(6) << "CCX"
+		<< std::setw(10) << "Threads"
+		<< std::setw(10) << "Highest"
+		<< std::setw(10) << "Nominal"
+		<< std::setw(14) << "Measured MHz"
+		<< "Stable" << std::endl;
+
+	for (size_t i = 0; i < ranking.size(); i++)
+	{
+		const CoreRank& rank = ranking[i];
+		std::cout << std::setw(6) << i + 1
+			<< std::setw(6) << rank.core
+			<< std::setw(6) << rank.ccx
+			<< std::setw(10) << formatThreadList(rank.threadMask)
+			<< std::setw(10) << rank.highestPerf
+			<< std::setw(10) << rank.nominalPerf
+			<< std::setw(14) << std::fixed << std::setprecision(0) << rank.measuredMhz
+			<< (rank.stable ? "yes" : "NO") << std::defaultfloat << std::endl;
+	}
+
+	std::cout << std::right << "--------------------------------------------------\n"
+		<< "Best cores (affinity mask, thread list):" << std::endl;
+
+	DWORD_PTR mask = 0;
+	for (size_t count = 1, i = 0; i < ranking.size(); i++)
+	{
+		mask |= ranking[i].threadMask;
+		if (i + 1 == count || i + 1 == ranking.size())
+		{
+			std::cout << "Top " << i + 1 << ": 0x" << std::hex << mask << std::dec
+				<< " (" << formatThreadList(mask) << ")" << std::endl;
+			count *= 2;
+		}
+	}
+}
+
+static bool readCppcCapability(CoreRank& rank)
+{
+	try
+	{
+		// CPPC_CAP1[31:24] HighestPerf, [23:16] NominalPerf, [15:8] LowNonlinPerf, [7:0] LowestPerf
+		uint64_t capability = readMsr(CPPC_CAPABILITY_REGISTER, rank.threadMask & (~rank.threadMask + 1));
+		rank.highestPerf = (capability >> 24) & 0xFF;
+		rank.nominalPerf = (capability >> 16) & 0xFF;
+		return true;
+	}
+	catch (const std::runtime_error&)
+	{
+		// CPPC was introduced with Zen 2
+		return false;
+	}
+}
+
+static void stressCore(CoreRank& rank, DWORD durationMs, double tscHz)
+{
+	TraceSpan span("stressCore", "core", rank.core);
+
+	int thread = getThreadsInMask(rank.threadMask).front();
+	std::exception_ptr error;
+
+	// the stress runs on its own pinned thread and reads its own clock counters,
+	// so sampling doesn't move anything between cores
+	std::thread worker([&]() {
+		try
+		{
+			pinCurrentThread(thread);
+			DWORD_PTR mask = (DWORD_PTR)1 << thread;
+
+			ClockCounters before = readClockCounters(mask);
+			if (!runStressKernel(rank.core, durationMs))
+			{
+				rank.stable = false;
+			}
+			ClockCounters after = readClockCounters(mask);
+
+			rank.measuredMhz = calculateEffectiveFrequency(before, after, tscHz);
+		}
+		catch (...)
+		{
+			error = std::current_exception();
+		}
+	});
+	worker.join();
+
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
+}
@@ -0,0 +1,22 @@
+﻿#pragma once
+#include <vector>
+
+#include <Windows.h>
+
+struct CoreRank
+{
+	int core{ 0 };
+	int ccx{ 0 };
+	DWORD_PTR threadMask{ 0 };
+	int highestPerf{ 0 }; // CPPC highest performance, 0 if CPPC is not available
+	int nominalPerf{ 0 }; // CPPC nominal performance
+	double measuredMhz{ 0 }; // effective frequency under single core stress, 0 if not measured
+	bool stable{ true }; // false if the stress produced a wrong result
+};
+
+// ranks all cores by their CPPC highest performance and, if a stress duration is given, by the
+// effective frequency measured while stressing one core at a time. best core first
+std::vector<CoreRank> rankCores(int numThreads, DWORD stressDurationMs);
+
+// prints the ranking and affinity masks / thread lists for the best 1, 2, 4, ... cores
+void printCoreRanking(const std::vector<CoreRank>& ranking);
@@ -0,0 +1,80 @@
+﻿#include "CpuStatus.h"
+
+#include "Msr.h"
+
+// constants
+static constexpr unsigned int PSTATE_CONTROL_REGISTER{ 0xC0010062 };
+static constexpr unsigned int PSTATE_STATUS_REGISTER{ 0xC0010063 };
+static constexpr unsigned int MPERF_REGISTER{ 0xE7 };
+static constexpr unsigned int APERF_REGISTER{ 0xE8 };
+static constexpr unsigned int RAPL_POWER_UNIT_REGISTER{ 0xC0010299 };
+static constexpr unsigned int CORE_ENERGY_REGISTER{ 0xC001029A };
+static constexpr unsigned int PACKAGE_ENERGY_REGISTER{ 0xC001029B };
+static constexpr uint32_t THM_TCON_CUR_TMP{ 0x00059800 };
+
+int readCurrentPstate(DWORD_PTR mask)
+{
+	// PStateStat[2:0] CurPstate
+	return readMsr(PSTATE_STATUS_REGISTER, mask) & 0x7;
+}
+
+int readPstateControl(DWORD_PTR mask)
+{
+	// PStateCtl[2:0] PstateCmd
+	return readMsr(PSTATE_CONTROL_REGISTER, mask) & 0x7;
+}
+
+void writePstateControl(int pstate, DWORD_PTR mask)
+{
+	uint64_t value = readMsr(PSTATE_CONTROL_REGISTER, mask);
+	writeMsr(PSTATE_CONTROL_REGISTER, (value & ~(uint64_t)0x7) | (pstate & 0x7), mask);
+}
+
+ClockCounters readClockCounters(DWORD_PTR mask)
+{
+	ClockCounters counters;
+	counters.mperf = readMsr(MPERF_REGISTER, mask);
+	counters.aperf = readMsr(APERF_REGISTER, mask);
+	return counters;
+}
+
+double calculateEffectiveFrequency(const ClockCounters& before, const ClockCounters& after, double tscHz)
+{
+	uint64_t mperfDelta = after.mperf - before.mperf;
+	if (!mperfDelta)
+	{
+		return 0;
+	}
+
+	return tscHz * (after.aperf - before.aperf) / mperfDelta / 1e6;
+}
+
+double readEnergyUnit()
+{
+	// RAPL_PWR_UNIT[12:8] energy status units, one count is 1 / 2^ESU joules
+	uint64_t units = readMsr(RAPL_POWER_UNIT_REGISTER, 0x1);
+	return 1.0 / ((uint64_t)1 << ((units >> 8) & 0x1F));
+}
+
+uint32_t readCoreEnergy(DWORD_PTR mask)
+{
+	return (uint32_t)readMsr(CORE_ENERGY_REGISTER, mask);
+}
+
+uint32_t readPackageEnergy()
+{
+	return (uint32_t)readMsr(PACKAGE_ENERGY_REGISTER, 0x1);
+}
+
+double readTemperature(SmnAccess& smn)
+{
+	// THM_TCON_CUR_TMP[31:21] current temperature in 0.125 degree steps,
+	// [19] range select, the reported range is shifted by -49 degrees if set
+	uint32_t value = smn.read(THM_TCON_CUR_TMP);
+	double temperature = (value >> 21) * 0.125;
+	if (value & (1 << 19))
+	{
+		temperature -= 49;
+	}
+	return temperature;
+}
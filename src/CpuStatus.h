@@ -0,0 +1,34 @@
+﻿#pragma once
+#include <cstdint>
+
+#include <Windows.h>
+
+#include "Smn.h"
+
+struct ClockCounters
+{
+	uint64_t aperf{ 0 }; // counts actual core clocks while not halted
+	uint64_t mperf{ 0 }; // counts at the P0 (TSC) rate while not halted
+};
+
+// reads the pstate the thread selected by the mask is currently running in (PStateStat)
+int readCurrentPstate(DWORD_PTR mask);
+
+// requested pstate (PStateCtl), the OS normally changes it on every performance state transition
+int readPstateControl(DWORD_PTR mask);
+void writePstateControl(int pstate, DWORD_PTR mask);
+
+ClockCounters readClockCounters(DWORD_PTR mask);
+
+// average frequency (in MHz) of the thread while it wasn't halted between two samples
+double calculateEffectiveFrequency(const ClockCounters& before, const ClockCounters& after, double tscHz);
+
+// joules per count of the energy status registers
+double readEnergyUnit();
+
+// 32 bit energy counters, they wrap around within minutes under load
+uint32_t readCoreEnergy(DWORD_PTR mask);
+uint32_t readPackageEnergy();
+
+// control temperature (Tctl) in degrees celsius from the SMU thermal registers
+double readTemperature(SmnAccess& smn);
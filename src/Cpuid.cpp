@@ -17,6 +17,8 @@ constexpr unsigned int CPU_FAMILY_ZEN{ 0x17 };
 
 // prototypes
 static void cpuid(int registers[4], int level);
+static unsigned int extractFamily(int eax);
+static unsigned int extractModel(int eax);
 
 bool validateCpu()
 {
@@ -37,19 +39,7 @@ bool validateCpu()
 		return false;
 	}
 
-	cpuid(registers, 1); // get family and model
-
-	/* EAX Register
-	 * |  31   30   29   28 | 27   26   25   24   23   22   21   20 | 19   18   17   16 |
-	 * | Reserved           | Extended Family ID                    | Extended Model ID |
-
-	 * |  15   14 | 13   12 | 11   10    9    8 |  7    6    5    4 |  3    2    1    0 |
-	 * | Reserved | ProcType| Family ID         | Model             | Stepping ID       |
-	 */
-	unsigned int family = ((registers[0] >> 8) & 0xf) + ((registers[0] >> 20) & 0xff);
-	unsigned int model = ((registers[0] >> 4) & 0xf) + (((registers[0] >> 16) & 0xf) << 4);
-
-	if (family != CPU_FAMILY_ZEN) {
+	if (getCpuFamily() != CPU_FAMILY_ZEN) {
 		std::cerr << "CPU is not AMD Zen" << std::endl;
 		return false;
 	}
@@ -57,6 +47,44 @@ bool validateCpu()
 	return true;
 }
 
+unsigned int getCpuFamily()
+{
+	int registers[4];
+	cpuid(registers, 1); // get family and model
+	return extractFamily(registers[0]);
+}
+
+unsigned int getCpuModel()
+{
+	int registers[4];
+	cpuid(registers, 1); // get family and model
+	return extractModel(registers[0]);
+}
+
+unsigned int getCpuSignature()
+{
+	int registers[4];
+	cpuid(registers, 1);
+	return (unsigned int)registers[0];
+}
+
+/* EAX Register of CPUID level 1
+ * |  31   30   29   28 | 27   26   25   24   23   22   21   20 | 19   18   17   16 |
+ * | Reserved           | Extended Family ID                    | Extended Model ID |
+
+ * |  15   14 | 13   12 | 11   10    9    8 |  7    6    5    4 |  3    2    1    0 |
+ * | Reserved | ProcType| Family ID         | Model             | Stepping ID       |
+ */
+static unsigned int extractFamily(int eax)
+{
+	return ((eax >> 8) & 0xf) + ((eax >> 20) & 0xff);
+}
+
+static unsigned int extractModel(int eax)
+{
+	return ((eax >> 4) & 0xf) + (((eax >> 16) & 0xf) << 4);
+}
+
 static void cpuid(int registers[4], int level)
 {
 #if defined(__GNUC__)
@@ -1,3 +1,10 @@
 ﻿#pragma once
 
 bool validateCpu();
+
+// family and model including the extended family and model fields
+unsigned int getCpuFamily();
+unsigned int getCpuModel();
+
+// raw EAX of CPUID level 1: stepping, model and family, identifies the silicon revision
+unsigned int getCpuSignature();
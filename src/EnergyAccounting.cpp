@@ -0,0 +1,373 @@
+﻿#include "EnergyAccounting.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+#include <TlHelp32.h>
+
+#include "Smn.h"
+#include "StopSignal.h"
+#include "Threads.h"
+#include "Topology.h"
+#include "Trace.h"
+
+// prototypes
+static double getCollectorCpuSeconds();
+static std::string toUtf8(const WCHAR* str);
+
+EnergyAccountant::EnergyAccountant(int numThreads, double tscHz, const std::string& csvPath)
+	:startCpuSeconds(getCollectorCpuSeconds())
+{
+	for (const CoreInfo& core : getCores(numThreads))
+	{
+		coreThreads.push_back(getThreadsInMask(core.threadMask).front());
+	}
+
+	account.tscHz = tscHz;
+
+	if (!csvPath.empty())
+	{
+		csv.open(csvPath);
+		if (!csv)
+		{
+			throw std::runtime_error("Failed to create '" + csvPath + "'");
+		}
+		csv << "seconds,pid,name,cycles,core_joules,package_joules\n";
+	}
+
+	// processes that already run are only charged for what they use from now on
+	scanProcesses(true);
+	intervalCycles.clear();
+}
+
+EnergyAccountant::~EnergyAccountant()
+{
+	for (auto& process : tracked)
+	{
+		if (process.second.handle)
+		{
+			CloseHandle(process.second.handle);
+		}
+	}
+}
+
+void EnergyAccountant::charge(const SystemSample& sample)
+{
+	TraceSpan span("chargeEnergy");
+
+	intervalCycles.clear();
+	scanProcesses(false);
+
+	double coreJoules = 0;
+	for (int thread : coreThreads)
+	{
+		coreJoules += sample.cpus[thread].corePowerWatts * sample.intervalSeconds;
+	}
+	double packageJoules = sample.packagePowerWatts * sample.intervalSeconds;
+
+	// MPERF only counts while a thread is busy, at the TSC rate
+	uint64_t busyTicks = 0;
+	uint64_t pstateTicks[ACCOUNTING_NUM_PSTATES]{};
+	for (const CpuSample& cpuSample : sample.cpus)
+	{
+		busyTicks += cpuSample.mperfDelta;
+		if (cpuSample.pstate >= 0 && cpuSample.pstate < ACCOUNTING_NUM_PSTATES)
+		{
+			pstateTicks[cpuSample.pstate] += cpuSample.mperfDelta;
+		}
+	}
+
+	uint64_t chargedCycles = 0;
+	for (const auto& charge : intervalCycles)
+	{
+		chargedCycles += charge.second;
+	}
+
+	// the cycle counts of the processes and MPERF don't match exactly, whatever is larger is all busy time
+	double busy = (double)std::max(busyTicks, chargedCycles);
+	double chargedShare = 0;
+
+	for (const auto& charge : intervalCycles)
+	{
+		ProcessEnergy& process = account.processes[charge.first];
+		double share = charge.second / busy;
+		chargedShare += share;
+
+		process.cycles += charge.second;
+		process.coreJoules += coreJoules * share;
+		process.packageJoules += packageJoules * share;
+		for (int pstate = 0; pstate < ACCOUNTING_NUM_PSTATES && busyTicks; pstate++)
+		{
+			process.pstateCycles[pstate] += (double)charge.second * pstateTicks[pstate] / busyTicks;
+		}
+
+		if (csv.is_open())
+		{
+			csv << account.seconds + sample.intervalSeconds << "," << process.pid << "," << process.name << ","
+				<< charge.second << "," << coreJoules * share << "," << packageJoules * share << "\n";
+		}
+	}
+
+	for (int pstate = 0; pstate < ACCOUNTING_NUM_PSTATES; pstate++)
+	{
+		account.pstateBusySeconds[pstate] += pstateTicks[pstate] / account.tscHz;
+	}
+
+	account.seconds += sample.intervalSeconds;
+	account.coreJoules += coreJoules;
+	account.packageJoules += packageJoules;
+	account.unattributedCoreJoules += coreJoules * std::max(1 - chargedShare, 0.0);
+}
+
+const EnergyAccount& EnergyAccountant::getAccount()
+{
+	account.collectorCpuSeconds = getCollectorCpuSeconds() - startCpuSeconds;
+	return account;
+}
+
+void EnergyAccountant::scanProcesses(bool baseline)
+{
+	HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+	if (snapshot == INVALID_HANDLE_VALUE)
+	{
+		throw std::runtime_error("Failed to take a snapshot of the process list");
+	}
+
+	for (auto& process : tracked)
+	{
+		process.second.seen = false;
+	}
+
+	PROCESSENTRY32W entry;
+	entry.dwSize = sizeof(entry);
+
+	for (BOOL found = Process32FirstW(snapshot, &entry); found; found = Process32NextW(snapshot, &entry))
+	{
+		auto it = tracked.find(entry.th32ProcessID);
+
+		// the pid was reused: the old process gets its last cycles, the new one starts from zero
+		if (it != tracked.end() && it->second.handle && WaitForSingleObject(it->second.handle, 0) == WAIT_OBJECT_0)
+		{
+			collect(it->second);
+			account.processes[it->second.index].exited = true;
+			CloseHandle(it->second.handle);
+			tracked.erase(it);
+			it = tracked.end();
+		}
+
+		if (it == tracked.end())
+		{
+			track(entry.th32ProcessID, entry.szExeFile, baseline);
+		}
+		else
+		{
+			it->second.seen = true;
+		}
+	}
+
+	CloseHandle(snapshot);
+
+	// the handle of an exited process still answers, so its last interval is charged as well
+	for (auto it = tracked.begin(); it != tracked.end();)
+	{
+		collect(it->second);
+
+		if (it->second.seen)
+		{
+			++it;
+			continue;
+		}
+
+		if (it->second.handle)
+		{
+			account.processes[it->second.index].exited = true;
+			CloseHandle(it->second.handle);
+		}
+		it = tracked.erase(it);
+	}
+}
+
+void EnergyAccountant::track(DWORD pid, const WCHAR* name, bool baseline)
+{
+	TrackedProcess process{ OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid), 0, account.processes.size(), true };
+
+	// processes started in the interval are charged for all of their cycles
+	ULONG64 cycles = 0;
+	if (baseline && process.handle && QueryProcessCycleTime(process.handle, &cycles))
+	{
+		process.lastCycles = cycles;
+	}
+
+	ProcessEnergy energy;
+	energy.pid = pid;
+	energy.name = toUtf8(name);
+	account.processes.push_back(energy);
+	tracked[pid] = process;
+}
+
+void EnergyAccountant::collect(TrackedProcess& process)
+{
+	ULONG64 cycles;
+	if (!process.handle || !QueryProcessCycleTime(process.handle, &cycles) || cycles <= process.lastCycles)
+	{
+		return;
+	}
+
+	intervalCycles.emplace_back(process.index, cycles - process.lastCycles);
+	process.lastCycles = cycles;
+}
+
+EnergyAccount runEnergyAccounting(int numThreads, DWORD intervalMs, DWORD durationMs, const std::string& csvPath)
+{
+	PciSmnAccess smn;
+	Sampler sampler(numThreads, smn);
+	EnergyAccountant accountant(numThreads, sampler.getTscFrequency(), csvPath);
+
+	installStopHandler();
+	std::cout << "Accounting the energy of all processes every " << intervalMs << " ms, press Ctrl+C to stop" << std::endl;
+
+	for (DWORD elapsed = 0; !isStopRequested() && (!durationMs || elapsed < durationMs); elapsed += intervalMs)
+	{
+		Sleep(intervalMs);
+		accountant.charge(sampler.sample());
+	}
+
+	removeStopHandler();
+
+	return accountant.getAccount();
+}
+
+void printEnergyAccount(const EnergyAccount& account, size_t top, bool byName)
+{
+	struct Row
+	{
+		std::string label;
+		size_t processes;
+		const ProcessEnergy* first;
+		ProcessEnergy total;
+	};
+
+	std::vector<Row> rows;
+	std::map<std::string, size_t> rowOfName;
+
+	for (const ProcessEnergy& process : account.processes)
+	{
+		if (!process.cycles)
+		{
+			continue;
+		}
+
+		if (byName && rowOfName.count(process.name))
+		{
+			Row& row = rows[rowOfName[process.name]];
+			row.processes++;
+			row.total.cycles += process.cycles;
+			row.total.coreJoules += process.coreJoules;
+			row.total.packageJoules += process.packageJoules;
+			for (int pstate = 0; pstate < ACCOUNTING_NUM_PSTATES; pstate++)
+			{
+				row.total.pstateCycles[pstate] += process.pstateCycles[pstate];
+			}
+			continue;
+		}
+
+		rowOfName[process.name] = rows.size();
+		rows.push_back({ process.name, 1, &process, process });
+	}
+
+	std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) { return a.total.coreJoules > b.total.coreJoules; });
+
+	// only the pstates that were used get a residency column
+	std::vector<int> pstates;
+	double busySeconds = 0;
+	for (int pstate = 0; pstate < ACCOUNTING_NUM_PSTATES; pstate++)
+	{
+		busySeconds += account.pstateBusySeconds[pstate];
+		if (account.pstateBusySeconds[pstate] > 0)
+		{
+			pstates.push_back(pstate);
+		}
+	}
+
+	std::streamsize precision = std::cout.precision();
+	std::cout << std::fixed << std::setprecision(1) << std::left
+		<< std::setw(28) << (byName ? "Executable" : "Process") << std::setw(10) << (byName ? "Count" : "PID")
+		<< std::setw(10) << "CPU s" << std::setw(12) << "Core J" << std::setw(12) << "Package J";
+	for (int pstate : pstates)
+	{
+		std::cout << std::setw(8) << ("P" + std::to_string(pstate) + " %");
+	}
+	std::cout << std::endl;
+
+	for (size_t i = 0; i < rows.size() && i < top; i++)
+	{
+		const Row& row = rows[i];
+		std::string count = byName ? std::to_string(row.processes)
+			: std::to_string(row.first->pid) + (row.first->exited ? "*" : "");
+
+		std::cout << std::setw(28) << row.label.substr(0, 27) << std::setw(10) << count
+			<< std::setw(10) << row.total.cycles / account.tscHz << std::setw(12) << row.total.coreJoules
+			<< std::setw(12) << row.total.packageJoules;
+		for (int pstate : pstates)
+		{
+			std::cout << std::setw(8) << row.total.pstateCycles[pstate] * 100 / row.total.cycles;
+		}
+		std::cout << std::endl;
+	}
+
+	if (rows.size() > top)
+	{
+		std::cout << "(" << rows.size() - top << " more)" << std::endl;
+	}
+	if (!byName)
+	{
+		std::cout << "* exited" << std::endl;
+	}
+
+	std::cout << "\nAccounted " << account.seconds << " s: package " << account.packageJoules << " J, cores "
+		<< account.coreJoules << " J, of which " << account.unattributedCoreJoules << " J not charged to any process" << std::endl;
+
+	std::cout << "Pstate residency of the busy time:";
+	for (int pstate : pstates)
+	{
+		std::cout << " P" << pstate << " " << account.pstateBusySeconds[pstate] * 100 / busySeconds << "%";
+	}
+	std::cout << std::endl;
+
+	std::cout << std::setprecision(3) << "Collector CPU time: " << account.collectorCpuSeconds << " s ("
+		<< (account.seconds > 0 ? account.collectorCpuSeconds * 100 / account.seconds : 0) << "% of a core)" << std::endl;
+
+	std::cout << std::defaultfloat << std::setprecision(precision) << std::right;
+}
+
+static double getCollectorCpuSeconds()
+{
+	FILETIME creation, exitTime, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exitTime, &kernel, &user))
+	{
+		return 0;
+	}
+
+	// 100 ns units
+	auto toSeconds = [](const FILETIME& time) {
+		return (((uint64_t)time.dwHighDateTime << 32) | time.dwLowDateTime) / 1e7;
+	};
+	return toSeconds(kernel) + toSeconds(user);
+}
+
+static std::string toUtf8(const WCHAR* str)
+{
+	// the report and the CSV file are narrow, executable names may use any character
+	int size = WideCharToMultiByte(CP_UTF8, 0, str, -1, nullptr, 0, nullptr, nullptr);
+	if (size <= 1)
+	{
+		return std::string();
+	}
+
+	std::string converted(size, '\0');
+	WideCharToMultiByte(CP_UTF8, 0, str, -1, &converted[0], size, nullptr, nullptr);
+	converted.resize(size - 1);
+	return converted;
+}
@@ -0,0 +1,83 @@
+﻿#pragma once
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <Windows.h>
+
+#include "Sampler.h"
+
+static constexpr int ACCOUNTING_NUM_PSTATES{ 8 };
+
+// energy charged to one process over its accounted lifetime
+struct ProcessEnergy
+{
+	DWORD pid{ 0 };
+	std::string name; // executable name
+	uint64_t cycles{ 0 }; // CPU cycles of all its threads
+	double coreJoules{ 0 };
+	double packageJoules{ 0 }; // its share of the package energy, including the uncore
+	double pstateCycles[ACCOUNTING_NUM_PSTATES]{}; // its cycles split by the pstate residency of the busy threads
+	bool exited{ false };
+};
+
+struct EnergyAccount
+{
+	double tscHz{ 0 };
+	double seconds{ 0 };
+	double coreJoules{ 0 }; // all cores
+	double packageJoules{ 0 };
+	double unattributedCoreJoules{ 0 }; // busy time no process was charged for (interrupts, protected processes)
+	double pstateBusySeconds[ACCOUNTING_NUM_PSTATES]{}; // busy time of all threads per pstate
+	std::vector<ProcessEnergy> processes;
+	double collectorCpuSeconds{ 0 }; // CPU time of the accounting itself
+};
+
+// charges the energy of every sample interval to the processes that ran in it. Windows doesn't
+// tell which process runs on which thread without an ETW session, so the energy of all cores is
+// split by the share of the busy time (MPERF) every process spent (QueryProcessCycleTime). the
+// energy idle cores use is part of that, so the processes also carry the cost of idling
+class EnergyAccountant
+{
+public:
+	// csvPath: optional, gets one line per charged process and interval
+	EnergyAccountant(int numThreads, double tscHz, const std::string& csvPath);
+	virtual ~EnergyAccountant();
+
+	EnergyAccountant(const EnergyAccountant&) = delete;
+	EnergyAccountant& operator=(const EnergyAccountant&) = delete;
+
+	// charges the interval of the sample to the processes that ran since the previous call
+	void charge(const SystemSample& sample);
+
+	// with the CPU time the accounting used so far
+	const EnergyAccount& getAccount();
+
+private:
+	struct TrackedProcess
+	{
+		HANDLE handle; // nullptr if the process can't be opened, it is never charged
+		uint64_t lastCycles;
+		size_t index; // into account.processes
+		bool seen;
+	};
+
+	std::vector<int> coreThreads; // first thread of every core, the core energy counter is shared
+	std::ofstream csv;
+	EnergyAccount account;
+	std::map<DWORD, TrackedProcess> tracked;
+	std::vector<std::pair<size_t, uint64_t>> intervalCycles; // [index, cycles] of the current interval
+	double startCpuSeconds;
+
+	void scanProcesses(bool baseline);
+	void track(DWORD pid, const WCHAR* name, bool baseline);
+	void collect(TrackedProcess& process);
+};
+
+// samples every interval and charges the energy until Ctrl+C or the duration (0: unlimited) is over
+EnergyAccount runEnergyAccounting(int numThreads, DWORD intervalMs, DWORD durationMs, const std::string& csvPath);
+
+// processes (or executables, with byName) by charged energy, with their pstate residency
+void printEnergyAccount(const EnergyAccount& account, size_t top, bool byName);
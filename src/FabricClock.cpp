@@ -0,0 +1,130 @@
+﻿#include "FabricClock.h"
+
+#include <cmath>
+#include <exception>
+#include <iostream>
+
+#include "Cpuid.h"
+#include "Smu.h"
+
+// constants
+// UMC0 DramConfiguration[6:0] MemClkFreq, MEMCLK in units of 100/3 MHz
+static constexpr uint32_t UMC_DRAM_CONFIG_ADDRESS{ 0x00050200 };
+static constexpr uint32_t MEMCLK_RATIO_MASK{ 0x7F };
+
+// models 0x00 - 0x2F are Zen and Zen+, the fabric of Zen 2 has a clock of its own
+static constexpr unsigned int FIRST_ZEN2_MODEL{ 0x30 };
+static constexpr DWORD SMU_TIMEOUT_MS{ 1000 };
+
+// clocks within 1% count as the same clock, the SMU reports measured values
+static constexpr double COUPLING_TOLERANCE{ 0.01 };
+
+// prototypes
+static bool isSameClock(double a, double b);
+static void printRatio(const char* name, double clockMhz, double memclkMhz);
+
+double readMemoryClock(SmnAccess& smn)
+{
+	return (smn.read(UMC_DRAM_CONFIG_ADDRESS) & MEMCLK_RATIO_MASK) * 100.0 / 3;
+}
+
+FabricClocks readFabricClocks(SmnAccess& smn)
+{
+	FabricClocks clocks;
+	clocks.memclkMhz = readMemoryClock(smn);
+
+	unsigned int model = getCpuModel();
+	const SmuMessageTable* table = findSmuMessageTable(model);
+
+	if (table)
+	{
+		Smu smu(smn, *table, SMU_TIMEOUT_MS);
+		if (smu.canReadClocks())
+		{
+			SmuClocks smuClocks = smu.readClocks();
+			if (!smuClocks.fclkMhz)
+			{
+				std::cerr << "Warning: unknown power table version, FCLK and UCLK are not read" << std::endl;
+				return clocks;
+			}
+
+			clocks.fclkMhz = smuClocks.fclkMhz;
+			clocks.uclkMhz = smuClocks.uclkMhz;
+			clocks.fromSmu = true;
+			return clocks;
+		}
+	}
+
+	if (model < FIRST_ZEN2_MODEL)
+	{
+		clocks.fclkMhz = clocks.memclkMhz;
+		clocks.uclkMhz = clocks.memclkMhz;
+	}
+
+	return clocks;
+}
+
+FabricClocks tryReadFabricClocks(SmnAccess& smn)
+{
+	try
+	{
+		return readFabricClocks(smn);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "Warning: failed to read the fabric clocks: " << e.what() << std::endl;
+		return FabricClocks();
+	}
+}
+
+void printFabricClocks(const FabricClocks& clocks)
+{
+	std::cout << "MEMCLK (MHz): " << clocks.memclkMhz << " (DDR4-" << std::lround(clocks.memclkMhz * 2) << ")" << std::endl;
+
+	if (!clocks.fclkMhz || !clocks.uclkMhz)
+	{
+		std::cout << "FCLK and UCLK can't be read on this CPU" << std::endl;
+		return;
+	}
+
+	std::cout << "UCLK (MHz): " << clocks.uclkMhz
+		<< "\nFCLK (MHz): " << clocks.fclkMhz
+		<< (clocks.fromSmu ? "" : "\n(Zen and Zen+ run FCLK and UCLK at MEMCLK)") << std::endl;
+
+	printRatio("UCLK", clocks.uclkMhz, clocks.memclkMhz);
+	printRatio("FCLK", clocks.fclkMhz, clocks.memclkMhz);
+
+	if (isSameClock(clocks.fclkMhz, clocks.memclkMhz) && isSameClock(clocks.uclkMhz, clocks.memclkMhz))
+	{
+		std::cout << "FCLK, UCLK and MEMCLK are coupled 1:1" << std::endl;
+	}
+	else
+	{
+		std::cout << "FCLK, UCLK and MEMCLK are not coupled, crossing between the clock domains adds memory latency" << std::endl;
+	}
+}
+
+static bool isSameClock(double a, double b)
+{
+	return std::abs(a - b) <= COUPLING_TOLERANCE * b;
+}
+
+static void printRatio(const char* name, double clockMhz, double memclkMhz)
+{
+	std::cout << name << ":MEMCLK ";
+	if (isSameClock(clockMhz, memclkMhz))
+	{
+		std::cout << "1:1";
+	}
+	else if (isSameClock(clockMhz * 2, memclkMhz))
+	{
+		std::cout << "1:2";
+	}
+	else
+	{
+		std::streamsize precision = std::cout.precision(3);
+		std::cout << clockMhz / memclkMhz << ":1";
+		std::cout.precision(precision);
+	}
+	std::cout << std::endl;
+}
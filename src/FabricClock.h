@@ -0,0 +1,24 @@
+﻿#pragma once
+
+#include "Smn.h"
+
+struct FabricClocks
+{
+	double fclkMhz{ 0 }; // infinity fabric, 0 if unknown
+	double uclkMhz{ 0 }; // memory controller, 0 if unknown
+	double memclkMhz{ 0 }; // DRAM clock, half the transfer rate
+	bool fromSmu{ false }; // FCLK and UCLK were read from the SMU, otherwise they follow from the architecture
+};
+
+// MEMCLK from the DRAM configuration of the first memory controller (UMC)
+double readMemoryClock(SmnAccess& smn);
+
+// MEMCLK from the UMC, FCLK and UCLK from the SMU power metrics table where it is known (Matisse).
+// Zen and Zen+ always run the fabric and the memory controller at MEMCLK
+FabricClocks readFabricClocks(SmnAccess& smn);
+
+// for the telemetry, prints a warning and returns zeros instead of throwing
+FabricClocks tryReadFabricClocks(SmnAccess& smn);
+
+// prints the clocks and whether FCLK, UCLK and MEMCLK are coupled 1:1
+void printFabricClocks(const FabricClocks& clocks);
@@ -0,0 +1,282 @@
+﻿#include "Freeze.h"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include "CState.h"
+#include "ChildProcess.h"
+#include "CpuStatus.h"
+#include "Msr.h"
+#include "StopSignal.h"
+#include "Threads.h"
+#include "Trace.h"
+
+// constants
+static constexpr unsigned int HWCONF_REGISTER{ 0xC0010015 };
+static constexpr unsigned int PSTATE_CONTROL_REGISTER{ 0xC0010062 };
+static constexpr unsigned int PMGT_MISC_REGISTER{ 0xC0010292 };
+static constexpr unsigned int CSTATE_CONFIG_REGISTER{ 0xC0010296 };
+static constexpr unsigned int SAVED_REGISTERS[]{ HWCONF_REGISTER, PSTATE_CONTROL_REGISTER, PMGT_MISC_REGISTER, CSTATE_CONFIG_REGISTER };
+
+// HWCR[25] CpbDis, disables core performance boost
+static constexpr uint64_t CPB_DISABLE{ (uint64_t)1 << 25 };
+
+static constexpr char DEFAULT_STATE_NAME[]{ "ryzen_pstates_freeze.txt" };
+static constexpr DWORD PIN_INTERVAL_MS{ 100 };
+static constexpr DWORD STOP_GRACE_PERIOD_MS{ 5000 };
+
+// prototypes
+static void writeStateFile(const std::string& statePath, const std::vector<SavedRegister>& registers);
+static std::vector<SavedRegister> readStateFile(const std::string& statePath);
+static void restoreRegisters(const std::vector<SavedRegister>& registers);
+
+std::string getDefaultFreezeStatePath()
+{
+	char path[MAX_PATH];
+	DWORD length = GetModuleFileNameA(nullptr, path, MAX_PATH);
+	if (!length || length == MAX_PATH)
+	{
+		return DEFAULT_STATE_NAME;
+	}
+
+	std::string directory(path, length);
+	size_t separator = directory.find_last_of("\\/");
+	if (separator == std::string::npos)
+	{
+		return DEFAULT_STATE_NAME;
+	}
+
+	return directory.substr(0, separator + 1) + DEFAULT_STATE_NAME;
+}
+
+FreezeSession::FreezeSession(const std::string& statePath, int pstate, int numThreads)
+	:statePath(statePath), pstate(pstate), numThreads(numThreads), restored(false)
+{
+	TraceSpan span("FreezeSession", "pstate", pstate);
+
+	if (GetFileAttributesA(statePath.c_str()) != INVALID_FILE_ATTRIBUTES)
+	{
+		throw std::runtime_error("An interrupted freeze session was found in '" + statePath
+			+ "', restore it first with: ryzen_pstates freeze --restore");
+	}
+
+	for (int thread = 0; thread < numThreads; thread++)
+	{
+		for (unsigned int reg : SAVED_REGISTERS)
+		{
+			savedRegisters.push_back({ thread, reg, readMsr(reg, (DWORD_PTR)1 << thread) });
+		}
+	}
+
+	// nothing is changed before the snapshot is on disk
+	writeStateFile(statePath, savedRegisters);
+
+	try
+	{
+		DWORD_PTR allThreads = getAllThreadsMask(numThreads);
+		setCc6Enabled(false, allThreads);
+		setPc6Enabled(false, allThreads);
+
+		for (int thread = 0; thread < numThreads; thread++)
+		{
+			DWORD_PTR threadMask = (DWORD_PTR)1 << thread;
+			writeMsr(HWCONF_REGISTER, readMsr(HWCONF_REGISTER, threadMask) | CPB_DISABLE, threadMask);
+			writePstateControl(pstate, threadMask);
+		}
+	}
+	catch (const std::exception&)
+	{
+		restore();
+		throw;
+	}
+}
+
+FreezeSession::~FreezeSession()
+{
+	try
+	{
+		restore();
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+	}
+}
+
+int FreezeSession::reassertPstate()
+{
+	int reasserted = 0;
+	for (int thread = 0; thread < numThreads; thread++)
+	{
+		DWORD_PTR threadMask = (DWORD_PTR)1 << thread;
+		if (readPstateControl(threadMask) != pstate)
+		{
+			writePstateControl(pstate, threadMask);
+			reasserted++;
+		}
+	}
+
+	return reasserted;
+}
+
+int FreezeSession::getPstate() const
+{
+	return pstate;
+}
+
+void FreezeSession::restore()
+{
+	if (restored)
+	{
+		return;
+	}
+	restored = true;
+
+	TraceSpan span("restoreFreezeSession");
+	restoreRegisters(savedRegisters);
+	DeleteFileA(statePath.c_str());
+}
+
+bool restoreFreezeState(const std::string& statePath)
+{
+	if (GetFileAttributesA(statePath.c_str()) == INVALID_FILE_ATTRIBUTES)
+	{
+		return false;
+	}
+
+	restoreRegisters(readStateFile(statePath));
+	if (!DeleteFileA(statePath.c_str()))
+	{
+		throw std::runtime_error("Registers restored, but failed to remove '" + statePath + "'");
+	}
+
+	return true;
+}
+
+DWORD runFrozen(const std::string& commandLine, const std::string& statePath, int pstate, int numThreads)
+{
+	FreezeSession session(statePath, pstate, numThreads);
+	std::cout << "Boost off, C6 off, all threads in P" << pstate << ", session saved to " << statePath << std::endl;
+
+	// the command shares our console, so it receives Ctrl+C as well and can shut down by itself
+	installStopHandler();
+	try
+	{
+		ChildProcess child(commandLine);
+
+		DWORD stopWaitedMs = 0;
+		while (!child.wait(PIN_INTERVAL_MS))
+		{
+			if (isStopRequested())
+			{
+				stopWaitedMs += PIN_INTERVAL_MS;
+				if (stopWaitedMs >= STOP_GRACE_PERIOD_MS)
+				{
+					std::cerr << "The command didn't exit after Ctrl+C, terminating it" << std::endl;
+					TerminateProcess(child.getHandle(), 1);
+					child.wait(INFINITE);
+					break;
+				}
+			}
+
+			// windows changes PStateCtl on every performance state transition
+			session.reassertPstate();
+		}
+
+		removeStopHandler();
+		std::cout << "Command exited, restoring the previous state" << std::endl;
+		return child.getExitCode();
+	}
+	catch (const std::exception&)
+	{
+		removeStopHandler();
+		throw;
+	}
+}
+
+static void writeStateFile(const std::string& statePath, const std::vector<SavedRegister>& registers)
+{
+	std::ostringstream content;
+	content << "# ryzen_pstates freeze session, restore with: ryzen_pstates freeze --restore\n"
+		<< "# thread register value\n" << std::hex;
+	for (const SavedRegister& saved : registers)
+	{
+		content << std::dec << saved.thread << std::hex << " 0x" << saved.reg << " 0x" << saved.value << "\n";
+	}
+	std::string text = content.str();
+
+	// written through, the snapshot must be on disk if the next thing that happens is a crash
+	HANDLE file = CreateFileA(statePath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_NEW,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_WRITE_THROUGH, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		throw std::runtime_error("Failed to create freeze session file '" + statePath + "'");
+	}
+
+	DWORD written;
+	BOOL success = WriteFile(file, text.data(), (DWORD)text.size(), &written, nullptr)
+		&& written == text.size() && FlushFileBuffers(file);
+	CloseHandle(file);
+
+	if (!success)
+	{
+		DeleteFileA(statePath.c_str());
+		throw std::runtime_error("Failed to write freeze session file '" + statePath + "'");
+	}
+}
+
+static std::vector<SavedRegister> readStateFile(const std::string& statePath)
+{
+	std::ifstream file(statePath);
+	if (!file)
+	{
+		throw std::runtime_error("Failed to open freeze session file '" + statePath + "'");
+	}
+
+	std::vector<SavedRegister> registers;
+	std::string line;
+	while (std::getline(file, line))
+	{
+		if (line.empty() || line[0] == '#')
+		{
+			continue;
+		}
+
+		SavedRegister saved;
+		std::istringstream fields(line);
+		fields >> std::dec >> saved.thread >> std::hex >> saved.reg >> saved.value;
+		if (!fields)
+		{
+			throw std::runtime_error("Invalid line in freeze session file '" + statePath + "': " + line);
+		}
+		registers.push_back(saved);
+	}
+
+	return registers;
+}
+
+static void restoreRegisters(const std::vector<SavedRegister>& registers)
+{
+	// keep going on errors, as much as possible should be restored
+	int failures = 0;
+	for (const SavedRegister& saved : registers)
+	{
+		try
+		{
+			writeMsr(saved.reg, saved.value, (DWORD_PTR)1 << saved.thread);
+		}
+		catch (const std::runtime_error& e)
+		{
+			std::cerr << "Thread " << saved.thread << ": " << e.what() << std::endl;
+			failures++;
+		}
+	}
+
+	if (failures)
+	{
+		throw std::runtime_error("Failed to restore " + std::to_string(failures) + " registers");
+	}
+}
@@ -0,0 +1,53 @@
+﻿#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <Windows.h>
+
+// register value of one thread from before a freeze session
+struct SavedRegister
+{
+	int thread{ 0 };
+	unsigned int reg{ 0 };
+	uint64_t value{ 0 };
+};
+
+// the session file next to the executable, used if no other path is given
+std::string getDefaultFreezeStatePath();
+
+// reproducible clocks for benchmarks: boost off, every thread requests the same pstate and core and
+// package C6 are disabled. every register that gets changed is saved to the session file (written
+// through) before the first change, so an interrupted session can be restored later.
+// the destructor restores the registers and removes the file
+class FreezeSession
+{
+public:
+	FreezeSession(const std::string& statePath, int pstate, int numThreads);
+	virtual ~FreezeSession();
+
+	FreezeSession(const FreezeSession&) = delete;
+	FreezeSession& operator=(const FreezeSession&) = delete;
+
+	// requests the pstate again on threads the OS moved away from it, returns the number of threads
+	int reassertPstate();
+
+	int getPstate() const;
+
+private:
+	std::string statePath;
+	int pstate;
+	int numThreads;
+	std::vector<SavedRegister> savedRegisters;
+	bool restored;
+
+	void restore();
+};
+
+// restores the registers of a session file left behind by an interrupted session and removes it,
+// returns false if there is no such file
+bool restoreFreezeState(const std::string& statePath);
+
+// runs the command line in a freeze session, Ctrl+C is passed on to the command and the session is
+// restored once it exits. returns the exit code of the command
+DWORD runFrozen(const std::string& commandLine, const std::string& statePath, int pstate, int numThreads);
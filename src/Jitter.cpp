@@ -0,0 +1,277 @@
+﻿#include "Jitter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include "CpuStatus.h"
+#include "Statistics.h"
+#include "Threads.h"
+#include "Trace.h"
+#include "Tsc.h"
+
+// constants
+static constexpr double WINDOW_SECONDS{ 0.001 };
+static constexpr size_t MAX_GAPS_PER_THREAD{ 1 << 16 };
+static constexpr int HISTOGRAM_BUCKETS{ 12 }; // powers of two from 1 us, the last one is open
+
+// prototypes
+static void spin(int thread, uint64_t durationTicks, uint64_t thresholdTicks, double tscHz, JitterResult& result);
+static void markAllThreadGaps(std::vector<JitterResult>& results);
+static bool hasOverlappingGap(const JitterResult& result, const JitterGap& gap);
+static std::string formatPstates(const std::vector<JitterGap>& gaps);
+
+std::vector<JitterResult> detectJitter(DWORD_PTR mask, DWORD durationMs, double thresholdUs, double tscHz)
+{
+	TraceSpan span("detectJitter", "mask", mask);
+
+	if (thresholdUs <= 0)
+	{
+		throw std::invalid_argument("Gap threshold must be positive");
+	}
+
+	std::vector<int> threads = getThreadsInMask(mask);
+	std::vector<JitterResult> results(threads.size());
+	std::vector<std::thread> workers;
+	std::atomic<bool> failed{ false };
+	std::exception_ptr error;
+
+	uint64_t durationTicks = (uint64_t)(durationMs / 1000.0 * tscHz);
+	uint64_t thresholdTicks = (uint64_t)(thresholdUs / 1e6 * tscHz);
+
+	for (size_t i = 0; i < threads.size(); i++)
+	{
+		workers.emplace_back([&, i]() {
+			try
+			{
+				spin(threads[i], durationTicks, thresholdTicks, tscHz, results[i]);
+			}
+			catch (...)
+			{
+				if (!failed.exchange(true))
+				{
+					error = std::current_exception();
+				}
+			}
+		});
+	}
+
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
+
+	markAllThreadGaps(results);
+	return results;
+}
+
+void printJitterReport(const std::vector<JitterResult>& results, double tscHz)
+{
+	double ticksToUs = 1e6 / tscHz;
+
+	std::cout << std::left << std::setw(8) << "Thread" << std::setw(8) << "Gaps" << std::setw(10) << "Gaps/s"
+		<< std::setw(10) << "Max us" << std::setw(10) << "Lost %" << std::setw(10) << "All-core"
+		<< std::setw(11) << "Pstate ch" << std::setw(11) << "MHz quiet" << std::setw(10) << "MHz gaps"
+		<< "Pstates" << std::endl;
+	std::streamsize precision = std::cout.precision();
+	std::cout << std::fixed;
+
+	std::vector<uint64_t> histogram(HISTOGRAM_BUCKETS, 0);
+	std::vector<uint64_t> allLengths;
+
+	for (const JitterResult& result : results)
+	{
+		uint64_t maxTicks = 0;
+		uint64_t lostTicks = 0;
+		size_t allThreads = 0;
+		size_t pstateChanges = 0;
+
+		for (const JitterGap& gap : result.gaps)
+		{
+			maxTicks = std::max(maxTicks, gap.ticks);
+			lostTicks += gap.ticks;
+			allThreads += gap.allThreads;
+			pstateChanges += gap.pstateChanged;
+			allLengths.push_back(gap.ticks);
+
+			int bucket = (int)std::floor(std::log2(std::max(gap.ticks * ticksToUs, 1.0)));
+			histogram[std::min(bucket, HISTOGRAM_BUCKETS - 1)]++;
+		}
+
+		double seconds = result.spinTicks / tscHz;
+		size_t numGaps = result.gaps.size() + result.droppedGaps;
+
+		std::cout << std::setw(8) << result.thread << std::setw(8) << numGaps
+			<< std::setprecision(1) << std::setw(10) << (seconds > 0 ? numGaps / seconds : 0)
+			<< std::setw(10) << maxTicks * ticksToUs
+			<< std::setprecision(3) << std::setw(10) << (result.spinTicks ? 100.0 * lostTicks / result.spinTicks : 0)
+			<< std::setw(10) << allThreads << std::setw(11) << pstateChanges
+			<< std::setprecision(0) << std::setw(11) << result.quietMhz << std::setw(10) << result.gapMhz
+			<< formatPstates(result.gaps) << std::endl;
+
+		if (result.droppedGaps)
+		{
+			std::cout << "  " << result.droppedGaps << " gaps didn't fit into the buffer and are only counted" << std::endl;
+		}
+	}
+
+	std::cout << std::defaultfloat << std::setprecision(precision) << std::right;
+
+	if (allLengths.empty())
+	{
+		std::cout << "No gaps above the threshold" << std::endl;
+		return;
+	}
+
+	std::cout << "\nGap length of all threads:" << std::endl;
+	printDistribution(summarize(allLengths, ticksToUs), "us");
+
+	uint64_t largest = *std::max_element(histogram.begin(), histogram.end());
+	std::cout << "\nHistogram:" << std::endl;
+	for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++)
+	{
+		if (!histogram[bucket])
+		{
+			continue;
+		}
+
+		std::ostringstream range;
+		if (bucket < HISTOGRAM_BUCKETS - 1)
+		{
+			range << (1 << bucket) << " - " << (2 << bucket) << " us";
+		}
+		else
+		{
+			range << ">= " << (1 << bucket) << " us";
+		}
+
+		std::cout << std::setw(16) << range.str() << std::setw(8) << histogram[bucket] << " "
+			<< std::string((size_t)(50.0 * histogram[bucket] / largest) + 1, '#') << std::endl;
+	}
+}
+
+static void spin(int thread, uint64_t durationTicks, uint64_t thresholdTicks, double tscHz, JitterResult& result)
+{
+	pinCurrentThread(thread);
+	DWORD_PTR mask = (DWORD_PTR)1 << thread;
+
+	result.thread = thread;
+	result.gaps.reserve(MAX_GAPS_PER_THREAD);
+
+	uint64_t windowTicks = (uint64_t)(WINDOW_SECONDS * tscHz);
+	uint64_t end = readTsc() + durationTicks;
+	ClockCounters quiet;
+	ClockCounters withGaps;
+
+	while (readTsc() < end)
+	{
+		// the counter reads go through the driver, they are outside of the timed window
+		int pstateBefore = readCurrentPstate(mask);
+		ClockCounters before = readClockCounters(mask);
+		size_t firstGap = result.gaps.size();
+		size_t droppedBefore = result.droppedGaps;
+
+		uint64_t windowStart = readTsc();
+		uint64_t windowEnd = windowStart + windowTicks;
+		uint64_t last = windowStart;
+		uint64_t now = last;
+
+		while (now < windowEnd)
+		{
+			now = readTsc();
+			if (now - last > thresholdTicks)
+			{
+				if (result.gaps.size() < MAX_GAPS_PER_THREAD)
+				{
+					JitterGap gap;
+					gap.start = last;
+					gap.ticks = now - last;
+					result.gaps.push_back(gap);
+				}
+				else
+				{
+					result.droppedGaps++;
+				}
+			}
+			last = now;
+		}
+
+		result.spinTicks += now - windowStart;
+
+		ClockCounters after = readClockCounters(mask);
+		int pstateAfter = readCurrentPstate(mask);
+
+		double windowMhz = calculateEffectiveFrequency(before, after, tscHz);
+		for (size_t i = firstGap; i < result.gaps.size(); i++)
+		{
+			result.gaps[i].windowMhz = windowMhz;
+			result.gaps[i].pstate = pstateAfter;
+			result.gaps[i].pstateChanged = pstateBefore != pstateAfter;
+		}
+
+		ClockCounters& total = result.gaps.size() > firstGap || result.droppedGaps > droppedBefore ? withGaps : quiet;
+		total.aperf += after.aperf - before.aperf;
+		total.mperf += after.mperf - before.mperf;
+	}
+
+	result.quietMhz = calculateEffectiveFrequency(ClockCounters(), quiet, tscHz);
+	result.gapMhz = calculateEffectiveFrequency(ClockCounters(), withGaps, tscHz);
+}
+
+static void markAllThreadGaps(std::vector<JitterResult>& results)
+{
+	if (results.size() < 2)
+	{
+		return;
+	}
+
+	// the TSC is synchronized between the threads, so the gaps can be compared directly
+	for (JitterResult& result : results)
+	{
+		for (JitterGap& gap : result.gaps)
+		{
+			gap.allThreads = std::all_of(results.begin(), results.end(), [&](const JitterResult& other) {
+				return &other == &result || hasOverlappingGap(other, gap);
+			});
+		}
+	}
+}
+
+static bool hasOverlappingGap(const JitterResult& result, const JitterGap& gap)
+{
+	// gaps are recorded in order, the first one ending after our start is the only candidate
+	auto candidate = std::lower_bound(result.gaps.begin(), result.gaps.end(), gap.start, [](const JitterGap& other, uint64_t start) {
+		return other.start + other.ticks <= start;
+	});
+
+	return candidate != result.gaps.end() && candidate->start < gap.start + gap.ticks;
+}
+
+static std::string formatPstates(const std::vector<JitterGap>& gaps)
+{
+	std::set<int> pstates;
+	for (const JitterGap& gap : gaps)
+	{
+		pstates.insert(gap.pstate);
+	}
+
+	std::ostringstream formatted;
+	for (int pstate : pstates)
+	{
+		formatted << (formatted.tellp() > 0 ? "," : "") << "P" << pstate;
+	}
+
+	return pstates.empty() ? "-" : formatted.str();
+}
@@ -0,0 +1,34 @@
+﻿#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <Windows.h>
+
+// a stretch of time the spinning thread didn't get to run
+struct JitterGap
+{
+	uint64_t start{ 0 }; // TSC of the last iteration before the gap
+	uint64_t ticks{ 0 };
+	double windowMhz{ 0 }; // effective frequency of the window the gap fell into
+	int pstate{ 0 }; // pstate at the end of the window
+	bool pstateChanged{ false }; // the pstate at the start of the window was a different one
+	bool allThreads{ false }; // every other measured thread had a gap at the same time, most likely an SMI
+};
+
+struct JitterResult
+{
+	int thread{ 0 };
+	uint64_t spinTicks{ 0 }; // time spent spinning, without the counter reads between windows
+	std::vector<JitterGap> gaps;
+	size_t droppedGaps{ 0 }; // gaps that didn't fit into the buffer
+	double quietMhz{ 0 }; // effective frequency of the windows without a gap
+	double gapMhz{ 0 }; // effective frequency of the windows with a gap
+};
+
+// spins on RDTSC on every thread in the mask at the same time and records every iteration that took
+// longer than the threshold. the loop runs in windows of about 1 ms, APERF/MPERF and the current
+// pstate are read between the windows, so each gap is attributed to the frequency of its window
+std::vector<JitterResult> detectJitter(DWORD_PTR mask, DWORD durationMs, double thresholdUs, double tscHz);
+
+// per thread hiccup rates and frequencies, followed by a histogram of the gap lengths
+void printJitterReport(const std::vector<JitterResult>& results, double tscHz);
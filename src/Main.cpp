@@ -1,38 +1,195 @@
-﻿#include <cstdint>
+﻿#include <algorithm>
+#include <cstdint>
 #include <exception>
+#include <fstream>
 #include <iostream>
+#include <memory>
 #include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
 #include <thread>
+#include <vector>
 
 #include <Windows.h>
 #include "lib/OlsApi.h"
 #include "lib/OlsDef.h"
 #include "lib/argh/argh.h"
 
+#include "ApplyDisturbance.h"
+#include "CState.h"
+#include "Certification.h"
+#include "ChildProcess.h"
+#include "CommandStream.h"
+#include "CoreLatency.h"
+#include "CoreRanking.h"
 #include "Cpuid.h"
+#include "EnergyAccounting.h"
+#include "FabricClock.h"
+#include "Freeze.h"
+#include "Jitter.h"
+#include "Msr.h"
+#include "Pmc.h"
+#include "PowerBudget.h"
 #include "PowerState.h"
+#include "ProcessWatcher.h"
+#include "PrometheusExporter.h"
+#include "Profile.h"
+#include "Sampler.h"
+#include "Sensitivity.h"
+#include "SimulatedSmu.h"
+#include "Smu.h"
+#include "Telemetry.h"
+#include "TelemetryLog.h"
+#include "Threads.h"
+#include "Trace.h"
+#include "Tsc.h"
+#include "TscCheck.h"
+#include "VfCurve.h"
+#include "VoltageOffset.h"
+#include "WakeLatency.h"
 
-static constexpr unsigned int HWCONF_REGISTER{ 0xC0010015 };
+// returned when every thread already had the requested pstate, so scripts can tell reruns apart
+static constexpr int EXIT_NO_CHANGE{ 2 };
+static constexpr int WAKE_BENCHMARK_DEFAULT_SAMPLES{ 1000 };
+static constexpr DWORD WATCH_DEFAULT_INTERVAL_MS{ 20 };
+static constexpr DWORD PMC_DEFAULT_DURATION_MS{ 10000 };
+static constexpr DWORD PMC_DEFAULT_INTERVAL_MS{ 100 };
+static constexpr DWORD RANK_DEFAULT_STRESS_MS{ 2000 };
+static constexpr DWORD SMU_DEFAULT_TIMEOUT_MS{ 1000 };
+static constexpr DWORD TELEMETRY_DEFAULT_INTERVAL_MS{ 100 };
+static constexpr int C2C_DEFAULT_ITERATIONS{ 1000 };
+static constexpr DWORD CERTIFY_DEFAULT_DURATION_MS{ 60000 };
+static constexpr double VF_DEFAULT_MARGIN_MV{ 25 };
+static constexpr DWORD LOG_DEFAULT_INTERVAL_MS{ 10 };
+static constexpr double ANALYZE_DEFAULT_BUCKET_S{ 60 };
+static constexpr DWORD JITTER_DEFAULT_DURATION_MS{ 10000 };
+static constexpr double JITTER_DEFAULT_THRESHOLD_US{ 10 };
+static constexpr char BUDGET_DEFAULT_CALIBRATION[]{ "ryzen_pstates_budget.txt" };
+static constexpr DWORD BUDGET_DEFAULT_DURATION_MS{ 5000 };
+static constexpr double BUDGET_DEFAULT_SENSITIVITY{ 1.0 };
+static constexpr DWORD PROMETHEUS_DEFAULT_INTERVAL_MS{ 1000 };
+static constexpr int DISTURB_DEFAULT_REPETITIONS{ 20 };
+static constexpr DWORD ENERGY_DEFAULT_INTERVAL_MS{ 1000 };
+static constexpr size_t ENERGY_DEFAULT_TOP{ 20 };
 
 struct Params
 {
 	bool dryRun{ false };
+	bool force{ false };
+	std::string certificationDatabase;
 	unsigned int pstate{ UINT_MAX };
 	std::optional<unsigned int> fid;
 	std::optional<unsigned int> did;
 	std::optional<unsigned int> vid;
+	std::optional<double> mhz;
+	double margin{ 0 }; // volts
 };
 
 // prototypes
+int runCommand(const argh::parser& argParser, const std::vector<std::string>& childArgs);
 int initWinRing0();
-Params parseArguments(int argc, char* argv[]);
+Params parseArguments(const argh::parser& argParser);
+void resolveTargetFrequency(Params& params);
 void printUsage();
-void updatePstate(const Params& params, int numThreads);
-void applyPstate(const PowerState& powerState, int numThreads);
-void lockTsc(DWORD_PTR mask);
+void runCStateCommand(const argh::parser& argParser, int numThreads);
+void runWakeBenchCommand(const argh::parser& argParser, int numThreads);
+void runWatchCommand(const argh::parser& argParser, int numThreads);
+void runTscCheckCommand(const argh::parser& argParser, int numThreads);
+void runPmcCommand(const argh::parser& argParser, int numThreads);
+void runRankCommand(const argh::parser& argParser, int numThreads);
+void runSmuCommand(const argh::parser& argParser);
+void runTelemetryCommand(const argh::parser& argParser, int numThreads);
+void runProfileCommand(const argh::parser& argParser, const std::vector<std::string>& childArgs, int numThreads);
+void runC2cCommand(const argh::parser& argParser, int numThreads);
+void runCertifyCommand(const argh::parser& argParser, int numThreads);
+void runCurveCommand(const argh::parser& argParser);
+void runLogCommand(const argh::parser& argParser, int numThreads);
+void runAnalyzeCommand(const argh::parser& argParser);
+int runFreezeCommand(const argh::parser& argParser, const std::vector<std::string>& childArgs, int numThreads);
+void runJitterCommand(const argh::parser& argParser, int numThreads);
+int runOffsetCommand(const argh::parser& argParser, int numThreads);
+void runFabricCommand();
+void runBudgetCommand(const argh::parser& argParser, int numThreads);
+void runPrometheusCommand(const argh::parser& argParser, int numThreads);
+void runDisturbCommand(const argh::parser& argParser, int numThreads);
+void runEnergyCommand(const argh::parser& argParser, int numThreads);
+int runBatchCommand(const argh::parser& argParser, int numThreads);
+void runStreamCommand(const StreamCommand& command, StagedEdits& staged, const CertificationDatabase& certifications,
+	std::unique_ptr<Sampler>& sampler, SmnAccess& smn, int numThreads);
+std::vector<OperatingPoint> getOperatingPoints(const argh::parser& argParser, const PowerState& original);
+BudgetCalibration calibratePowerBudget(const std::vector<OperatingPoint>& points, const std::vector<CoreInfo>& cores,
+	DWORD durationMs, const CertificationDatabase& certifications, bool force, int numThreads);
+void applyBudgetAllocation(const BudgetCalibration& calibration, const std::vector<CoreGroup>& groups,
+	const std::vector<CoreInfo>& cores, const BudgetAllocation& allocation, const CertificationDatabase& certifications,
+	bool force, int numThreads);
+bool isSmuSimulation(const argh::parser& argParser);
+bool parseSwitch(const std::string& value, const std::string& name);
+bool updatePstate(const Params& params, int numThreads);
+bool applyPstate(const PowerState& powerState, int numThreads);
+bool applyPstates(const std::vector<PowerState>& powerStates, int numThreads);
 int getNumberOfHardwareThreads();
 
 int main(int argc, char* argv[]) {
+	if (argc == 1)
+	{
+		printUsage();
+		return -1;
+	}
+
+	// everything after "--" is the command line of a workload and not parsed by us
+	int ownArgc = 0;
+	while (ownArgc < argc && std::string(argv[ownArgc]) != "--")
+	{
+		ownArgc++;
+	}
+	std::vector<std::string> childArgs(argv + std::min(ownArgc + 1, argc), argv + argc);
+
+	argh::parser argParser(ownArgc, argv);
+
+	std::string tracePath;
+	if (argParser("--trace") >> tracePath)
+	{
+		enableTracing();
+	}
+
+	int ret = runCommand(argParser, childArgs);
+
+	if (!tracePath.empty())
+	{
+		try
+		{
+			writeTrace(tracePath);
+			std::cout << "Trace written to " << tracePath << std::endl;
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << e.what() << std::endl;
+		}
+	}
+
+	return ret;
+}
+
+int runCommand(const argh::parser& argParser, const std::vector<std::string>& childArgs)
+{
+	TraceSpan span("runCommand");
+
+	// the simulated SMU doesn't need any hardware access, so it also works on other CPUs
+	if (isSmuSimulation(argParser))
+	{
+		try
+		{
+			runSmuCommand(argParser);
+			return 0;
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << e.what() << "\nExiting..." << std::endl;
+			return -1;
+		}
+	}
+
 	int ret = initWinRing0();
 	if (ret)
 	{
@@ -40,33 +197,150 @@ int main(int argc, char* argv[]) {
 	}
 
 	int numThreads = getNumberOfHardwareThreads();
-	Params params = parseArguments(argc, argv);
 
 	try
 	{
-		updatePstate(params, numThreads);
+		const std::string& command = argParser[1];
+
+		if (command.empty())
+		{
+			Params params = parseArguments(argParser);
+			resolveTargetFrequency(params);
+			if (!updatePstate(params, numThreads) && !params.dryRun)
+			{
+				ret = EXIT_NO_CHANGE;
+			}
+		}
+		else if (command == "cstate")
+		{
+			runCStateCommand(argParser, numThreads);
+		}
+		else if (command == "wakebench")
+		{
+			runWakeBenchCommand(argParser, numThreads);
+		}
+		else if (command == "watch")
+		{
+			runWatchCommand(argParser, numThreads);
+		}
+		else if (command == "tsccheck")
+		{
+			runTscCheckCommand(argParser, numThreads);
+		}
+		else if (command == "pmc")
+		{
+			runPmcCommand(argParser, numThreads);
+		}
+		else if (command == "rank")
+		{
+			runRankCommand(argParser, numThreads);
+		}
+		else if (command == "smu")
+		{
+			runSmuCommand(argParser);
+		}
+		else if (command == "telemetry")
+		{
+			runTelemetryCommand(argParser, numThreads);
+		}
+		else if (command == "profile")
+		{
+			runProfileCommand(argParser, childArgs, numThreads);
+		}
+		else if (command == "c2c")
+		{
+			runC2cCommand(argParser, numThreads);
+		}
+		else if (command == "certify")
+		{
+			runCertifyCommand(argParser, numThreads);
+		}
+		else if (command == "curve")
+		{
+			runCurveCommand(argParser);
+		}
+		else if (command == "log")
+		{
+			runLogCommand(argParser, numThreads);
+		}
+		else if (command == "analyze")
+		{
+			runAnalyzeCommand(argParser);
+		}
+		else if (command == "freeze")
+		{
+			ret = runFreezeCommand(argParser, childArgs, numThreads);
+		}
+		else if (command == "jitter")
+		{
+			runJitterCommand(argParser, numThreads);
+		}
+		else if (command == "offset")
+		{
+			ret = runOffsetCommand(argParser, numThreads);
+		}
+		else if (command == "fabric")
+		{
+			runFabricCommand();
+		}
+		else if (command == "budget")
+		{
+			runBudgetCommand(argParser, numThreads);
+		}
+		else if (command == "prometheus")
+		{
+			runPrometheusCommand(argParser, numThreads);
+		}
+		else if (command == "disturb")
+		{
+			runDisturbCommand(argParser, numThreads);
+		}
+		else if (command == "energy")
+		{
+			runEnergyCommand(argParser, numThreads);
+		}
+		else if (command == "batch")
+		{
+			ret = runBatchCommand(argParser, numThreads);
+		}
+		else
+		{
+			throw std::invalid_argument("Unknown command '" + command + "'");
+		}
 	}
 	catch (const std::exception& e)
 	{
 		std::cerr << e.what() << "\nExiting..." << std::endl;
+		ret = -1;
 	}
 
-	DeinitializeOls();
+	{
+		TraceSpan deinitSpan("DeinitializeOls");
+		DeinitializeOls();
+	}
 
-	return 0;
+	return ret;
 }
 
 int initWinRing0()
 {
-	if (!validateCpu())
+	TraceSpan span("initWinRing0");
+
 	{
-		return -1;
+		TraceSpan validateSpan("validateCpu");
+		if (!validateCpu())
+		{
+			return -1;
+		}
 	}
 
-	if (!InitializeOls())
 	{
-		std::cerr << "WinRing0: Failed to initialize" << std::endl;
-		return -1;
+		TraceSpan initializeSpan("InitializeOls");
+		if (!InitializeOls())
+		{
+			std::cerr << "WinRing0: Failed to initialize" << std::endl;
+			return -1;
+		}
 	}
 
 	DWORD dllStatus = GetDllStatus();
@@ -100,18 +374,13 @@ int initWinRing0()
 	return 0;
 }
 
-Params parseArguments(int argc, char* argv[])
+Params parseArguments(const argh::parser& argParser)
 {
-	if (argc == 1)
-	{
-		printUsage();
-		exit(-1);
-	}
-
-	argh::parser argParser(argc, argv);
 	Params params;
 
 	params.dryRun = argParser["--dry-run"];
+	params.force = argParser["--force"];
+	argParser("--cert-db", getDefaultCertificationDatabasePath()) >> params.certificationDatabase;
 
 	// PState
 	auto curArg = argParser({ "-p", "--pstate" });
@@ -158,25 +427,1114 @@ Params parseArguments(int argc, char* argv[])
 		params.vid = std::optional<unsigned int>(temp);
 	}
 
+	// target frequency, FID, DID and VID are taken from the V/F curve
+	curArg = argParser("--mhz");
+	if (curArg)
+	{
+		if (params.fid || params.did || params.vid)
+		{
+			std::cerr << "--mhz can't be combined with --fid, --did or --vid" << std::endl;
+			printUsage();
+			exit(-1);
+		}
+
+		double temp;
+		curArg >> temp;
+		params.mhz = std::optional<double>(temp);
+	}
+
+	double marginMv;
+	argParser("--margin", VF_DEFAULT_MARGIN_MV) >> marginMv;
+	params.margin = marginMv / 1000;
+
 	return params;
 }
 
+void resolveTargetFrequency(Params& params)
+{
+	if (!params.mhz)
+	{
+		return;
+	}
+
+	CertificationDatabase certifications(params.certificationDatabase, readCpuIdentity());
+	VfPrediction prediction = buildVfCurve(certifications).predict(*params.mhz, params.margin);
+
+	std::cout << "Target " << *params.mhz << " MHz: ";
+	printVfPrediction(prediction, params.margin);
+	std::cout << "--------------------------------------------------" << std::endl;
+
+	params.fid = prediction.setting.fid;
+	params.did = prediction.setting.did;
+	params.vid = prediction.vid;
+}
+
 void printUsage()
 {
-	std::cout << "Options:\n"
+	std::cout << "Usage: ryzen_pstates [command] [options]\n\n"
+		<< "Commands:\n"
+		<< "(none)		Change a pstate using the options below\n"
+		<< "cstate		Display or change core (CC6) and package (PC6) C-state enablement\n"
+		<< "		--threads=0-3,8	Threads to display or change (default: all)\n"
+		<< "		--cc6=on|off	Enable or disable core C6\n"
+		<< "		--pc6=on|off	Enable or disable package C6\n"
+		<< "wakebench	Measure thread wake up latency with C-states enabled and disabled\n"
+		<< "		--threads=0-3,8	Sleeper threads to measure (default: last thread)\n"
+		<< "		--waker=0	Thread that wakes the sleepers (default: 0)\n"
+		<< "		--samples=1000	Wake ups to measure per sleeper thread and C-state setting\n"
+		<< "watch		Apply a pstate profile while a process is running, restore it when it exits\n"
+		<< "		--bind=name.exe=P:FID:DID:VID[,...][;...]	Profiles per process, '-' keeps a value\n"
+		<< "		--interval=20	Process list polling interval in ms\n"
+		<< "		--force		Apply profiles even if they are known to be unstable\n"
+		<< "tsccheck	Verify TSC rate, cross thread TSC skew and the TSC lock bit on every thread\n"
+		<< "		--expected-mhz=3600	Expected TSC rate (default: rate is only reported)\n"
+		<< "		--rate-tolerance=0.1	Allowed TSC rate deviation in percent\n"
+		<< "		--max-skew=1000	Allowed skew to thread 0 in TSC ticks\n"
+		<< "		--ignore-lock	Don't require LockTscToCurrentP0 to be set\n"
+		<< "pmc		Sample core performance counters and report IPC and miss rates per pstate\n"
+		<< "		--threads=0-3,8	Threads to sample (default: all)\n"
+		<< "		--duration=10000	Sampling duration in ms\n"
+		<< "		--interval=100	Sampling interval in ms\n"
+		<< "rank		Rank cores by CPPC highest performance and print affinity masks of the best cores\n"
+		<< "		--stress	Also measure the frequency of every core under a short single core stress\n"
+		<< "		--stress-duration=2000	Stress duration per core in ms (implies --stress)\n"
+		<< "smu		Read or set the PPT, TDC and EDC power limits through the SMU mailbox\n"
+		<< "		--ppt=88	New package power limit in W\n"
+		<< "		--tdc=60	New sustained current limit in A\n"
+		<< "		--edc=90	New peak current limit in A\n"
+		<< "		--timeout=1000	Time to wait for an SMU response in ms\n"
+		<< "		--simulate[=Matisse]	Talk to a simulated SMU instead of the hardware\n"
+		<< "		--simulate-hang	Simulated SMU never answers (to test timeouts)\n"
+		<< "telemetry	Publish frequency, pstate, temperature and power into shared memory until Ctrl+C\n"
+		<< "		--interval=100	Sampling interval in ms\n"
+		<< "		--name=Local\\RyzenPstatesTelemetry	Name of the shared memory segment\n"
+		<< "profile -- cmd	Run a workload once per operating point (as pstate 0) and report runtime, energy and EDP\n"
+		<< "		--points=FID:DID[,...]	Operating points to run (default: all enabled pstates)\n"
+		<< "		--vid=VID	VID for --points (default: current pstate 0 VID)\n"
+		<< "		--force		Run operating points even if they are known to be unstable\n"
+		<< "c2c		Measure the core to core round trip latency of every thread pair per pstate\n"
+		<< "		--threads=0-3,8	Threads to measure (default: all)\n"
+		<< "		--pstates=0,2	Pstates to request with PStateCtl during the measurement (default: 0)\n"
+		<< "		--iterations=1000	Round trips per thread pair\n"
+		<< "certify		Stress the pstate given with the options below and record the result for this CPU\n"
+		<< "		--duration=60000	Stress duration in ms\n"
+		<< "curve		Print the voltage/frequency curve from the pstates and the certification database\n"
+		<< "		--mhz=3800	Also predict FID, DID and VID for a target frequency\n"
+		<< "		--margin=25	Voltage margin on top of the curve in mV\n"
+		<< "log		Record frequency, pstate, energy and temperature samples into a binary log until Ctrl+C\n"
+		<< "		--file=log.bin	Required, log file to create\n"
+		<< "		--interval=10	Sampling interval in ms\n"
+		<< "		--duration=0	Stop after this many ms (default: only Ctrl+C)\n"
+		<< "analyze		Summarize a binary log per thread and per time bucket\n"
+		<< "		--file=log.bin	Required, log file to read\n"
+		<< "		--bucket=60	Length of a time bucket in s\n"
+		<< "freeze		Run a command with boost and C6 off and all threads in one pstate, then restore everything\n"
+		<< "		-- cmd args	Required, command line of the benchmark\n"
+		<< "		--pstate=0	Pstate to request on all threads\n"
+		<< "		--state=path	Session file for restoring after a crash (default: next to the executable)\n"
+		<< "		--restore	Restore an interrupted session instead of running a command\n"
+		<< "jitter		Spin on RDTSC on every thread and report gaps (SMIs, frequency excursions) per thread\n"
+		<< "		--threads=0-3	Threads to measure (default: all)\n"
+		<< "		--duration=10000	Measurement duration in ms\n"
+		<< "		--threshold=10	Shortest gap to record in us\n"
+		<< "offset		Move the voltage of all enabled pstates by the same offset\n"
+		<< "		--mv=-25	Required, voltage offset in mV, negative values undervolt\n"
+		<< "		--dry-run	Only display the new definitions\n"
+		<< "fabric		Display the infinity fabric (FCLK), memory controller (UCLK) and memory clock (MEMCLK)\n"
+		<< "budget		Pick a pstate 0 definition per core or CCX that maximizes throughput within a package power budget\n"
+		<< "		--watts=80	Package power budget in W\n"
+		<< "		--calibrate	Measure every operating point first, otherwise the saved calibration is used\n"
+		<< "		--points=fid:did,...	Operating points to calibrate (default: all enabled pstates)\n"
+		<< "		--vid=80	VID used for --points (default: the current pstate 0 VID)\n"
+		<< "		--duration=5000	Measurement duration per operating point in ms\n"
+		<< "		--calibration=path	Calibration file (default: ryzen_pstates_budget.txt)\n"
+		<< "		--group=core	Allocate per core or per ccx\n"
+		<< "		--sensitivity=1.0	How much the throughput depends on the clock (see profile)\n"
+		<< "		--follow	Read new budgets in W from stdin, one per line, and allocate again\n"
+		<< "		--dry-run	Only display the allocation\n"
+		<< "		--force		Apply operating points even if they are known to be unstable\n"
+		<< "prometheus	Write pstate definitions, frequency, power and temperature to a Prometheus textfile until Ctrl+C\n"
+		<< "		--file=path	Required, .prom file in the textfile collector directory\n"
+		<< "		--interval=1000	Export interval in ms\n"
+		<< "disturb		Measure the stall that applying a pstate causes to a latency sensitive loop, per apply strategy\n"
+		<< "		--pstate=0	Pstate whose current definition is written again\n"
+		<< "		--repetitions=20	Applies per strategy\n"
+		<< "		--threads=0-3	Threads running the loop (default: all)\n"
+		<< "energy		Charge the core and package energy to the processes by their CPU time, until Ctrl+C\n"
+		<< "		--interval=1000	Accounting interval in ms\n"
+		<< "		--duration=0	Accounting duration in ms (default: until Ctrl+C)\n"
+		<< "		--by=process	Report per process or per executable name\n"
+		<< "		--top=20	Number of rows to report\n"
+		<< "		--csv=path	Also write every charge per interval to a CSV file\n"
+		<< "batch		Run a stream of commands (read, set, apply, discard, verify, sample) with one initialization\n"
+		<< "		--file=path	Read the commands from a file instead of stdin\n"
+		<< "		--keep-going	Continue after a failed command\n\n"
+		<< "Options:\n"
 		<< "-p, --pstate	Required, Selects PState to change (0 - 7)\n"
 		<< "-f, --fid	New FID to set (" << +PowerState::FID_MIN << " - " << +PowerState::FID_MAX << ")\n"
 		<< "-d, --did	New DID to set (" << +PowerState::DID_MIN << " - " << +PowerState::DID_MAX << ")\n"
 		<< "-v, --vid	New VID to set (" << +PowerState::VID_MIN << " - " << +PowerState::VID_MAX << ")\n"
-		<< "--dry-run	Only display current and calculated new pstate, but don't apply it\n\n"
+		<< "--mhz		Target frequency instead of FID, DID and VID, the VID is predicted from the V/F curve\n"
+		<< "--margin=25	Voltage margin in mV for --mhz\n"
+		<< "--dry-run	Only display current and calculated new pstate, but don't apply it\n"
+		<< "--force		Apply or certify a pstate even if it is known to be unstable on this CPU\n"
+		<< "--cert-db=file	Certification database (default: ryzen_pstates_certified.txt next to the executable)\n"
+		<< "--trace=file.json	Write timing spans of all phases in Chrome trace event format (any command)\n\n"
 		<< "Example: ryzen_pstates -p=1 -f=102 -d=12 -v=96" << std::endl;
 }
 
-void updatePstate(const Params& params, int numThreads)
+void runCStateCommand(const argh::parser& argParser, int numThreads)
+{
+	std::string threadList;
+	argParser("--threads") >> threadList;
+	DWORD_PTR mask = parseThreadMask(threadList, numThreads);
+
+	std::string value;
+	if (argParser("--cc6") >> value)
+	{
+		setCc6Enabled(parseSwitch(value, "--cc6"), mask);
+	}
+
+	if (argParser("--pc6") >> value)
+	{
+		setPc6Enabled(parseSwitch(value, "--pc6"), mask);
+	}
+
+	printCStateConfig(mask);
+}
+
+void runWakeBenchCommand(const argh::parser& argParser, int numThreads)
+{
+	std::string threadList;
+	DWORD_PTR sleeperMask = (DWORD_PTR)1 << (numThreads - 1);
+	if (argParser("--threads") >> threadList)
+	{
+		sleeperMask = parseThreadMask(threadList, numThreads);
+	}
+
+	int wakerThread;
+	argParser("--waker", 0) >> wakerThread;
+	if (wakerThread < 0 || wakerThread >= numThreads)
+	{
+		throw std::invalid_argument("Waker thread out of bounds");
+	}
+
+	int samples;
+	argParser("--samples", WAKE_BENCHMARK_DEFAULT_SAMPLES) >> samples;
+	if (samples <= 0)
+	{
+		throw std::invalid_argument("Number of samples must be positive");
+	}
+
+	runWakeLatencyBenchmark(sleeperMask, wakerThread, samples);
+}
+
+void runWatchCommand(const argh::parser& argParser, int numThreads)
+{
+	std::string bindingSpec;
+	if (!(argParser("--bind") >> bindingSpec))
+	{
+		throw std::invalid_argument("Required parameter --bind missing");
+	}
+
+	DWORD intervalMs;
+	argParser("--interval", WATCH_DEFAULT_INTERVAL_MS) >> intervalMs;
+
+	bool force = argParser["--force"];
+	std::string databasePath;
+	argParser("--cert-db", getDefaultCertificationDatabasePath()) >> databasePath;
+	CertificationDatabase certifications(databasePath, readCpuIdentity());
+
+	watchProcesses(parseBindings(bindingSpec), certifications, force, numThreads, intervalMs);
+}
+
+void runTscCheckCommand(const argh::parser& argParser, int numThreads)
+{
+	TscCheckOptions options;
+
+	double expectedMhz;
+	if (argParser("--expected-mhz") >> expectedMhz)
+	{
+		options.expectedHz = expectedMhz * 1e6;
+	}
+
+	double rateTolerancePercent;
+	if (argParser("--rate-tolerance") >> rateTolerancePercent)
+	{
+		options.rateTolerance = rateTolerancePercent / 100;
+	}
+
+	argParser("--max-skew", options.maxSkewTicks) >> options.maxSkewTicks;
+	options.requireLock = !argParser["--ignore-lock"];
+
+	verifyTsc(numThreads, options);
+}
+
+void runPmcCommand(const argh::parser& argParser, int numThreads)
+{
+	std::string threadList;
+	argParser("--threads") >> threadList;
+	DWORD_PTR mask = parseThreadMask(threadList, numThreads);
+
+	DWORD durationMs;
+	argParser("--duration", PMC_DEFAULT_DURATION_MS) >> durationMs;
+
+	DWORD intervalMs;
+	argParser("--interval", PMC_DEFAULT_INTERVAL_MS) >> intervalMs;
+	if (intervalMs == 0)
+	{
+		throw std::invalid_argument("Sampling interval must be positive");
+	}
+
+	std::cout << "Sampling performance counters for " << durationMs << " ms..." << std::endl;
+	printPmcReport(samplePmcPerPstate(mask, durationMs, intervalMs));
+}
+
+void runRankCommand(const argh::parser& argParser, int numThreads)
+{
+	DWORD stressMs = 0;
+	if (argParser["--stress"])
+	{
+		stressMs = RANK_DEFAULT_STRESS_MS;
+	}
+	argParser("--stress-duration", stressMs) >> stressMs;
+
+	if (stressMs)
+	{
+		std::cout << "Stressing every core for " << stressMs << " ms..." << std::endl;
+	}
+
+	printCoreRanking(rankCores(numThreads, stressMs));
+}
+
+void runSmuCommand(const argh::parser& argParser)
+{
+	DWORD timeoutMs;
+	argParser("--timeout", SMU_DEFAULT_TIMEOUT_MS) >> timeoutMs;
+
+	std::unique_ptr<SmnAccess> smn;
+	const SmuMessageTable* table;
+
+	if (isSmuSimulation(argParser))
+	{
+		std::string tableName;
+		argParser("--simulate", "Matisse") >> tableName;
+		table = findSmuMessageTable(tableName.c_str());
+		if (!table)
+		{
+			throw std::invalid_argument("No SMU message table matches '" + tableName + "'");
+		}
+		smn = std::make_unique<SimulatedSmu>(*table, argParser["--simulate-hang"]);
+	}
+	else
+	{
+		table = findSmuMessageTable(getCpuModel());
+		if (!table)
+		{
+			throw std::runtime_error("The SMU of this CPU model is not supported");
+		}
+		smn = std::make_unique<PciSmnAccess>();
+	}
+
+	std::cout << "SMU: " << table->name << std::endl;
+	Smu smu(*smn, *table, timeoutMs);
+
+	double value;
+	if (argParser("--ppt") >> value)
+	{
+		smu.setPptLimit(value);
+		std::cout << "PPT limit set to " << value << " W" << std::endl;
+	}
+
+	if (argParser("--tdc") >> value)
+	{
+		smu.setTdcLimit(value);
+		std::cout << "TDC limit set to " << value << " A" << std::endl;
+	}
+
+	if (argParser("--edc") >> value)
+	{
+		smu.setEdcLimit(value);
+		std::cout << "EDC limit set to " << value << " A" << std::endl;
+	}
+
+	if (!smu.canReadLimits())
+	{
+		std::cout << "Reading the current limits is not supported on this CPU" << std::endl;
+		return;
+	}
+
+	PowerLimits limits = smu.readLimits();
+	std::cout << "PPT limit (W): " << limits.pptWatts
+		<< "\nTDC limit (A): " << limits.tdcAmps
+		<< "\nEDC limit (A): " << limits.edcAmps << std::endl;
+}
+
+void runTelemetryCommand(const argh::parser& argParser, int numThreads)
+{
+	DWORD intervalMs;
+	argParser("--interval", TELEMETRY_DEFAULT_INTERVAL_MS) >> intervalMs;
+	if (intervalMs == 0)
+	{
+		throw std::invalid_argument("Sampling interval must be positive");
+	}
+
+	std::string name;
+	argParser("--name", TELEMETRY_DEFAULT_NAME) >> name;
+
+	runTelemetryExport(name, numThreads, intervalMs);
+}
+
+void runProfileCommand(const argh::parser& argParser, const std::vector<std::string>& childArgs, int numThreads)
+{
+	if (childArgs.empty())
+	{
+		throw std::invalid_argument("Workload command missing, e.g. ryzen_pstates profile -- benchmark.exe");
+	}
+	std::string commandLine = buildCommandLine(childArgs);
+
+	bool force = argParser["--force"];
+	std::string databasePath;
+	argParser("--cert-db", getDefaultCertificationDatabasePath()) >> databasePath;
+	CertificationDatabase certifications(databasePath, readCpuIdentity());
+
+	PowerState original = readPowerState(0);
+	std::vector<OperatingPoint> points = getOperatingPoints(argParser, original);
+
+	// every point has to pass the check before the first one is written
+	std::vector<PowerState> powerStates;
+	for (const OperatingPoint& point : points)
+	{
+		PowerState powerState = original;
+		powerState.setFid(point.fid);
+		powerState.setDid(point.did);
+		powerState.setVid(point.vid);
+
+		std::cout << point.name << ": ";
+		checkCertification(certifications, powerState, force);
+		powerStates.push_back(powerState);
+	}
+
+	std::vector<WorkloadResult> results;
+	try
+	{
+		for (size_t i = 0; i < points.size(); i++)
+		{
+			const OperatingPoint& point = points[i];
+			const PowerState& powerState = powerStates[i];
+
+			std::cout << "Running '" << commandLine << "' at " << point.name << " ("
+				<< powerState.calculateFrequency() << " MHz)..." << std::endl;
+			applyPstate(powerState, numThreads);
+
+			WorkloadResult result = runWorkload(commandLine, numThreads);
+			result.point = point;
+			results.push_back(result);
+		}
+	}
+	catch (const std::exception&)
+	{
+		applyPstate(original, numThreads);
+		throw;
+	}
+
+	std::cout << "Restoring pstate 0" << std::endl;
+	applyPstate(original, numThreads);
+
+	printSensitivityReport(results);
+}
+
+void runC2cCommand(const argh::parser& argParser, int numThreads)
+{
+	std::string threadList;
+	argParser("--threads") >> threadList;
+	DWORD_PTR mask = parseThreadMask(threadList, numThreads);
+
+	std::string pstateList;
+	argParser("--pstates", "0") >> pstateList;
+	std::vector<int> pstates = parsePstateList(pstateList);
+
+	int iterations;
+	argParser("--iterations", C2C_DEFAULT_ITERATIONS) >> iterations;
+	if (iterations <= 0)
+	{
+		throw std::invalid_argument("Number of iterations must be positive");
+	}
+
+	std::vector<CoreInfo> cores = getCores(numThreads);
+	for (const LatencyMatrix& matrix : measureLatencyMatrices(mask, pstates, iterations, numThreads))
+	{
+		printLatencyMatrix(matrix, cores);
+		std::cout << "--------------------------------------------------" << std::endl;
+	}
+}
+
+void runCertifyCommand(const argh::parser& argParser, int numThreads)
+{
+	Params params = parseArguments(argParser);
+	resolveTargetFrequency(params);
+
+	DWORD durationMs;
+	argParser("--duration", CERTIFY_DEFAULT_DURATION_MS) >> durationMs;
+
+	PstateEdit edit;
+	edit.pstate = params.pstate;
+	edit.fid = params.fid;
+	edit.did = params.did;
+	edit.vid = params.vid;
+
+	PowerState original = readPowerState(params.pstate);
+	PowerState target = resolveEdit(edit);
+	std::cout << "Pstate to certify:" << std::endl;
+	target.print();
+	std::cout << "--------------------------------------------------" << std::endl;
+
+	CertificationDatabase certifications(params.certificationDatabase, readCpuIdentity());
+	checkCertification(certifications, target, params.force);
+
+	const CertificationRecord* previous = certifications.find(target);
+	if (previous && previous->result == CertificationResult::PASSED && previous->durationMs >= durationMs && !params.force)
+	{
+		std::cout << "Already certified, skipping the stress" << std::endl;
+		return;
+	}
+
+	// recorded first, if the system crashes during the stress the point stays marked as incomplete
+	certifications.add(makeCertificationRecord(target, durationMs));
+
+	applyPstate(target, numThreads);
+
+	std::cout << "Stressing all threads for " << durationMs << " ms..." << std::endl;
+	CertificationRecord record;
+	try
+	{
+		record = runCertificationStress(target, durationMs, numThreads);
+	}
+	catch (const std::exception&)
+	{
+		applyPstate(original, numThreads);
+		throw;
+	}
+
+	std::cout << "Restoring pstate " << params.pstate << std::endl;
+	applyPstate(original, numThreads);
+
+	certifications.add(record);
+	std::cout << "Result: " << formatCertificationResult(record.result) << ", temperature "
+		<< record.minTemperature << " - " << record.maxTemperature << " C" << std::endl;
+}
+
+void runCurveCommand(const argh::parser& argParser)
+{
+	std::string databasePath;
+	argParser("--cert-db", getDefaultCertificationDatabasePath()) >> databasePath;
+	CertificationDatabase certifications(databasePath, readCpuIdentity());
+
+	VfCurve curve = buildVfCurve(certifications);
+	curve.print();
+
+	double mhz;
+	if (argParser("--mhz") >> mhz)
+	{
+		double marginMv;
+		argParser("--margin", VF_DEFAULT_MARGIN_MV) >> marginMv;
+
+		std::cout << "--------------------------------------------------\n"
+			<< "Target " << mhz << " MHz: ";
+		printVfPrediction(curve.predict(mhz, marginMv / 1000), marginMv / 1000);
+	}
+}
+
+void runLogCommand(const argh::parser& argParser, int numThreads)
+{
+	std::string path;
+	if (!(argParser("--file") >> path))
+	{
+		throw std::invalid_argument("Required parameter --file missing");
+	}
+
+	DWORD intervalMs;
+	argParser("--interval", LOG_DEFAULT_INTERVAL_MS) >> intervalMs;
+	if (intervalMs == 0)
+	{
+		throw std::invalid_argument("Sampling interval must be positive");
+	}
+
+	DWORD durationMs;
+	argParser("--duration", 0) >> durationMs;
+
+	runTelemetryLog(path, numThreads, intervalMs, durationMs);
+}
+
+void runAnalyzeCommand(const argh::parser& argParser)
+{
+	std::string path;
+	if (!(argParser("--file") >> path))
+	{
+		throw std::invalid_argument("Required parameter --file missing");
+	}
+
+	double bucketSeconds;
+	argParser("--bucket", ANALYZE_DEFAULT_BUCKET_S) >> bucketSeconds;
+	if (bucketSeconds <= 0)
+	{
+		throw std::invalid_argument("Bucket length must be positive");
+	}
+
+	analyzeTelemetryLog(path, bucketSeconds);
+}
+
+int runFreezeCommand(const argh::parser& argParser, const std::vector<std::string>& childArgs, int numThreads)
+{
+	std::string statePath;
+	argParser("--state", getDefaultFreezeStatePath()) >> statePath;
+
+	if (argParser["--restore"])
+	{
+		if (!restoreFreezeState(statePath))
+		{
+			std::cout << "No interrupted freeze session in '" << statePath << "'" << std::endl;
+			return EXIT_NO_CHANGE;
+		}
+
+		std::cout << "Restored the freeze session from '" << statePath << "'" << std::endl;
+		return 0;
+	}
+
+	if (childArgs.empty())
+	{
+		throw std::invalid_argument("Benchmark command missing, e.g. ryzen_pstates freeze -- benchmark.exe");
+	}
+
+	int pstate;
+	argParser({ "-p", "--pstate" }, 0) >> pstate;
+	if (pstate < 0 || pstate > 7)
+	{
+		throw std::invalid_argument("Pstate must be between 0 and 7");
+	}
+
+	// the benchmark's exit code is ours, so scripts can check it
+	return (int)runFrozen(buildCommandLine(childArgs), statePath, pstate, numThreads);
+}
+
+void runJitterCommand(const argh::parser& argParser, int numThreads)
+{
+	std::string threadList;
+	argParser("--threads") >> threadList;
+	DWORD_PTR mask = parseThreadMask(threadList, numThreads);
+
+	DWORD durationMs;
+	argParser("--duration", JITTER_DEFAULT_DURATION_MS) >> durationMs;
+
+	double thresholdUs;
+	argParser("--threshold", JITTER_DEFAULT_THRESHOLD_US) >> thresholdUs;
+
+	double tscHz = calibrateTscFrequency();
+	std::cout << "Spinning on threads " << formatThreadList(mask) << " for " << durationMs << " ms..." << std::endl;
+
+	printJitterReport(detectJitter(mask, durationMs, thresholdUs, tscHz), tscHz);
+}
+
+int runOffsetCommand(const argh::parser& argParser, int numThreads)
 {
+	double offsetMv;
+	if (!(argParser("--mv") >> offsetMv))
+	{
+		throw std::invalid_argument("Required parameter --mv missing");
+	}
+
+	std::vector<PowerState> current = readEnabledPowerStates();
+	std::vector<PowerState> offset = applyVoltageOffset(current, offsetMv);
+	printVoltageOffset(current, offset);
+	std::cout << "--------------------------------------------------" << std::endl;
+
+	bool dryRun = argParser["--dry-run"];
+	bool force = argParser["--force"];
+	std::string databasePath;
+	argParser("--cert-db", getDefaultCertificationDatabasePath()) >> databasePath;
+
+	// every definition has to pass the check before the first one is written
+	CertificationDatabase certifications(databasePath, readCpuIdentity());
+	for (const PowerState& powerState : offset)
+	{
+		std::cout << "P" << powerState.getPstate() << ": ";
+		checkCertification(certifications, powerState, force || dryRun);
+	}
+
+	if (dryRun)
+	{
+		return 0;
+	}
+
+	return applyPstates(offset, numThreads) ? 0 : EXIT_NO_CHANGE;
+}
+
+void runFabricCommand()
+{
+	PciSmnAccess smn;
+	printFabricClocks(readFabricClocks(smn));
+}
+
+void runBudgetCommand(const argh::parser& argParser, int numThreads)
+{
+	double budgetWatts = 0;
+	bool hasBudget = static_cast<bool>(argParser("--watts") >> budgetWatts);
+	bool calibrate = argParser["--calibrate"];
+	bool follow = argParser["--follow"];
+	bool dryRun = argParser["--dry-run"];
+	if (!hasBudget && !calibrate && !follow)
+	{
+		throw std::invalid_argument("Required parameter --watts missing");
+	}
+
+	std::string calibrationPath;
+	argParser("--calibration", BUDGET_DEFAULT_CALIBRATION) >> calibrationPath;
+
+	std::string grouping;
+	argParser("--group", "core") >> grouping;
+	if (grouping != "core" && grouping != "ccx")
+	{
+		throw std::invalid_argument("Invalid value '" + grouping + "' for --group (must be core or ccx)");
+	}
+
+	double sensitivity;
+	argParser("--sensitivity", BUDGET_DEFAULT_SENSITIVITY) >> sensitivity;
+
+	// operating points come from the command line or the calibration file, so every one of them is
+	// checked before it is written as pstate 0
+	bool force = argParser["--force"];
+	std::string databasePath;
+	argParser("--cert-db", getDefaultCertificationDatabasePath()) >> databasePath;
+	CertificationDatabase certifications(databasePath, readCpuIdentity());
+
+	std::vector<CoreInfo> cores = getCores(numThreads);
+	BudgetCalibration calibration;
+	if (calibrate)
+	{
+		DWORD durationMs;
+		argParser("--duration", BUDGET_DEFAULT_DURATION_MS) >> durationMs;
+
+		calibration = calibratePowerBudget(getOperatingPoints(argParser, readPowerState(0)), cores, durationMs,
+			certifications, force, numThreads);
+		saveBudgetCalibration(calibrationPath, calibration);
+		std::cout << "Calibration saved to " << calibrationPath << std::endl;
+	}
+	else
+	{
+		calibration = loadBudgetCalibration(calibrationPath, cores.size());
+	}
+
+	std::vector<CoreGroup> groups = groupCores(cores, grouping == "ccx");
+	auto allocate = [&](double watts) {
+		BudgetAllocation allocation = allocatePowerBudget(calibration, groups, watts, sensitivity);
+		printBudgetAllocation(calibration, groups, allocation, watts);
+		if (!dryRun)
+		{
+			applyBudgetAllocation(calibration, groups, cores, allocation, certifications, force, numThreads);
+		}
+	};
+
+	if (hasBudget)
+	{
+		allocate(budgetWatts);
+	}
+
+	if (!follow)
+	{
+		return;
+	}
+
+	// the calibration stays loaded, so a new budget is solved and applied right away
+	std::cout << "Enter a new budget in W per line, end with Ctrl+Z" << std::endl;
+	std::string line;
+	while (std::getline(std::cin, line))
+	{
+		std::istringstream lineStream(line);
+		if (!(lineStream >> budgetWatts))
+		{
+			std::cerr << "Invalid budget '" << line << "'" << std::endl;
+			continue;
+		}
+
+		try
+		{
+			allocate(budgetWatts);
+		}
+		catch (const std::invalid_argument& e)
+		{
+			std::cerr << e.what() << std::endl;
+		}
+	}
+}
+
+std::vector<OperatingPoint> getOperatingPoints(const argh::parser& argParser, const PowerState& original)
+{
+	std::string pointSpec;
+	if (!(argParser("--points") >> pointSpec))
+	{
+		return getEnabledOperatingPoints();
+	}
+
+	// lower clocks at the current pstate 0 voltage are the safe default
+	unsigned int vid;
+	argParser("--vid", +original.getVid()) >> vid;
+	return parseOperatingPoints(pointSpec, vid);
+}
+
+BudgetCalibration calibratePowerBudget(const std::vector<OperatingPoint>& points, const std::vector<CoreInfo>& cores,
+	DWORD durationMs, const CertificationDatabase& certifications, bool force, int numThreads)
+{
+	PowerState original = readPowerState(0);
+	BudgetCalibration calibration;
+
+	// every point has to pass the check before the first one is written
+	std::vector<PowerState> powerStates;
+	for (const OperatingPoint& point : points)
+	{
+		PowerState powerState = original;
+		powerState.setFid(point.fid);
+		powerState.setDid(point.did);
+		powerState.setVid(point.vid);
+
+		std::cout << point.name << ": ";
+		checkCertification(certifications, powerState, force);
+		powerStates.push_back(powerState);
+	}
+
+	try
+	{
+		for (size_t i = 0; i < points.size(); i++)
+		{
+			const OperatingPoint& point = points[i];
+			const PowerState& powerState = powerStates[i];
+
+			std::cout << "Measuring " << point.name << " (" << powerState.calculateFrequency() << " MHz) under stress..." << std::endl;
+			applyPstate(powerState, numThreads);
+
+			calibration.points.push_back(point);
+			calibration.measurements.push_back(measureOperatingPoint(cores, numThreads, durationMs));
+		}
+	}
+	catch (const std::exception&)
+	{
+		applyPstate(original, numThreads);
+		throw;
+	}
+
+	std::cout << "Restoring pstate 0" << std::endl;
+	applyPstate(original, numThreads);
+
+	return calibration;
+}
+
+void applyBudgetAllocation(const BudgetCalibration& calibration, const std::vector<CoreGroup>& groups,
+	const std::vector<CoreInfo>& cores, const BudgetAllocation& allocation, const CertificationDatabase& certifications,
+	bool force, int numThreads)
+{
+	TraceSpan span("applyBudgetAllocation");
+	PowerState original = readPowerState(0);
+
+	std::vector<uint64_t> values(numThreads, original.getValue());
+	std::vector<bool> checked(calibration.points.size(), false);
+	for (size_t g = 0; g < groups.size(); g++)
+	{
+		const OperatingPoint& point = calibration.points[allocation.pointOfGroup[g]];
+		PowerState powerState = original;
+		powerState.setFid(point.fid);
+		powerState.setDid(point.did);
+		powerState.setVid(point.vid);
+
+		// the calibration file may hold points that were never certified, nothing is written before all are checked
+		if (!checked[allocation.pointOfGroup[g]])
+		{
+			std::cout << point.name << ": ";
+			checkCertification(certifications, powerState, force);
+			checked[allocation.pointOfGroup[g]] = true;
+		}
+
+		for (int core : groups[g])
+		{
+			for (int thread : getThreadsInMask(cores[core].threadMask))
+			{
+				values[thread] = powerState.getValue();
+			}
+		}
+	}
+
+	// every core gets its own pstate 0, the TSC has to stay at the current rate
+	TscCheckOptions tscCheckOptions;
+	tscCheckOptions.expectedHz = calibrateTscFrequency();
+	for (int thread = 0; thread < numThreads; thread++)
+	{
+		lockTsc((DWORD_PTR)1 << thread);
+	}
+
+	writeMsrOnAllThreads(PowerState::getRegister(0), values);
+	std::cout << "Pstate 0 updated on all " << numThreads << " threads" << std::endl;
+
+	verifyTsc(numThreads, tscCheckOptions);
+}
+
+void runPrometheusCommand(const argh::parser& argParser, int numThreads)
+{
+	std::string path;
+	if (!(argParser("--file") >> path))
+	{
+		throw std::invalid_argument("Required parameter --file missing");
+	}
+
+	DWORD intervalMs;
+	argParser("--interval", PROMETHEUS_DEFAULT_INTERVAL_MS) >> intervalMs;
+	if (intervalMs == 0)
+	{
+		throw std::invalid_argument("Export interval must be positive");
+	}
+
+	runPrometheusExport(path, numThreads, intervalMs);
+}
+
+void runDisturbCommand(const argh::parser& argParser, int numThreads)
+{
+	int pstate;
+	argParser("--pstate", 0) >> pstate;
+	if (pstate < 0 || pstate > 7)
+	{
+		throw std::invalid_argument("Pstate out of bounds");
+	}
+
+	int repetitions;
+	argParser("--repetitions", DISTURB_DEFAULT_REPETITIONS) >> repetitions;
+
+	std::string threadList;
+	argParser("--threads") >> threadList;
+	DWORD_PTR mask = parseThreadMask(threadList, numThreads);
+
+	double tscHz = calibrateTscFrequency();
+	std::cout << "Applying P" << pstate << " " << repetitions << " times per strategy while threads "
+		<< formatThreadList(mask) << " run the loop..." << std::endl;
+
+	printDisturbanceReport(measureApplyDisturbance(mask, pstate, repetitions, numThreads), tscHz);
+}
+
+void runEnergyCommand(const argh::parser& argParser, int numThreads)
+{
+	DWORD intervalMs;
+	argParser("--interval", ENERGY_DEFAULT_INTERVAL_MS) >> intervalMs;
+	if (intervalMs == 0)
+	{
+		throw std::invalid_argument("Accounting interval must be positive");
+	}
+
+	DWORD durationMs;
+	argParser("--duration", 0) >> durationMs;
+
+	std::string by;
+	argParser("--by", "process") >> by;
+	if (by != "process" && by != "name")
+	{
+		throw std::invalid_argument("--by must be process or name");
+	}
+
+	size_t top;
+	argParser("--top", ENERGY_DEFAULT_TOP) >> top;
+
+	std::string csvPath;
+	argParser("--csv") >> csvPath;
+
+	printEnergyAccount(runEnergyAccounting(numThreads, intervalMs, durationMs, csvPath), top, by == "name");
+}
+
+int runBatchCommand(const argh::parser& argParser, int numThreads)
+{
+	std::ifstream file;
+	std::istream* input = &std::cin;
+	std::string path;
+	if (argParser("--file") >> path)
+	{
+		file.open(path);
+		if (!file)
+		{
+			throw std::runtime_error("Failed to open command stream '" + path + "'");
+		}
+		input = &file;
+	}
+
+	bool keepGoing = argParser["--keep-going"];
+	std::string databasePath;
+	argParser("--cert-db", getDefaultCertificationDatabasePath()) >> databasePath;
+	CertificationDatabase certifications(databasePath, readCpuIdentity());
+
+	StagedEdits staged;
+	PciSmnAccess smn;
+	std::unique_ptr<Sampler> sampler;
+	int errors = 0;
+	int lineNumber = 0;
+	std::string line;
+
+	while (std::getline(*input, line))
+	{
+		lineNumber++;
+		try
+		{
+			std::optional<StreamCommand> command = parseStreamCommand(line);
+			if (!command)
+			{
+				continue;
+			}
+			if (command->verb == StreamVerb::QUIT)
+			{
+				break;
+			}
+
+			runStreamCommand(*command, staged, certifications, sampler, smn, numThreads);
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << "error line=" << lineNumber << " message=" << quoteStreamValue(e.what()) << std::endl;
+			errors++;
+			if (!keepGoing)
+			{
+				return -1;
+			}
+		}
+	}
+
+	// a forgotten apply must not look like success
+	if (staged.size())
+	{
+		std::cout << "error line=" << lineNumber << " message="
+			<< quoteStreamValue(std::to_string(staged.size()) + " staged edit(s) were never applied") << std::endl;
+		errors++;
+	}
+
+	return errors ? -1 : 0;
+}
+
+void runStreamCommand(const StreamCommand& command, StagedEdits& staged, const CertificationDatabase& certifications,
+	std::unique_ptr<Sampler>& sampler, SmnAccess& smn, int numThreads)
+{
+	TraceSpan span("runStreamCommand", "verb", (uint64_t)command.verb);
+
+	if (command.verb == StreamVerb::READ)
+	{
+		for (int pstate = command.pstate.value_or(0); pstate <= command.pstate.value_or(7); pstate++)
+		{
+			std::cout << "ok read " << formatPowerStateFields(readPowerState(pstate)) << std::endl;
+		}
+	}
+	else if (command.verb == StreamVerb::SET)
+	{
+		std::cout << "ok set " << formatPowerStateFields(staged.stage(command.edit)) << " staged=" << staged.size() << std::endl;
+	}
+	else if (command.verb == StreamVerb::DISCARD)
+	{
+		std::cout << "ok discard staged=" << staged.size() << std::endl;
+		staged.clear();
+	}
+	else if (command.verb == StreamVerb::APPLY)
+	{
+		std::vector<PowerState> powerStates = staged.getStaged();
+		std::string pstates;
+		bool changed = false;
+
+		if (!powerStates.empty())
+		{
+			DiagnosticsToStderr diagnostics;
+
+			// every definition has to pass the check before the first one is written
+			for (const PowerState& powerState : powerStates)
+			{
+				checkCertification(certifications, powerState, command.force);
+				pstates += (pstates.empty() ? "" : ",") + std::to_string(powerState.getPstate());
+			}
+
+			// one pass over the threads, only registers that differ are written
+			changed = applyPstates(powerStates, numThreads);
+		}
+
+		staged.clear();
+		std::cout << "ok apply pstates=" << pstates << " changed=" << changed << std::endl;
+	}
+	else if (command.verb == StreamVerb::VERIFY)
+	{
+		std::string inconsistent;
+		for (int pstate = 0; pstate < 8; pstate++)
+		{
+			std::vector<uint64_t> values = readMsrOnAllThreads(PowerState::getRegister(pstate), numThreads);
+			if (std::any_of(values.begin(), values.end(), [&](uint64_t value) { return value != values.front(); }))
+			{
+				inconsistent += (inconsistent.empty() ? "P" : ", P") + std::to_string(pstate);
+			}
+		}
+
+		if (!inconsistent.empty())
+		{
+			throw std::runtime_error("The threads have different definitions of " + inconsistent);
+		}
+
+		TscCheckResult result = checkTsc(numThreads, TscCheckOptions());
+		if (!result.failures.empty())
+		{
+			throw std::runtime_error("TSC verification failed: " + result.failures.front());
+		}
+
+		std::cout << "ok verify threads=" << numThreads << " tsc_mhz=" << result.frequencyHz / 1e6 << std::endl;
+	}
+	else if (command.verb == StreamVerb::SAMPLE)
+	{
+		// the first sample calibrates the TSC, later ones reuse the sampler
+		if (!sampler)
+		{
+			sampler = std::make_unique<Sampler>(numThreads, smn);
+		}
+		else
+		{
+			sampler->sample();
+		}
+
+		Sleep(command.sampleMs);
+		const SystemSample& sample = sampler->sample();
+
+		std::cout << "ok sample seconds=" << sample.intervalSeconds << " temperature=" << sample.temperature
+			<< " package_watts=" << sample.packagePowerWatts << std::endl;
+		for (const CpuSample& cpuSample : sample.cpus)
+		{
+			std::cout << "ok sample cpu=" << cpuSample.cpu << " pstate=" << cpuSample.pstate << " mhz=" << cpuSample.frequencyMhz
+				<< " core_watts=" << cpuSample.corePowerWatts << std::endl;
+		}
+	}
+}
+
+bool isSmuSimulation(const argh::parser& argParser)
+{
+	return argParser[1] == "smu" && (argParser["--simulate"] || argParser("--simulate"));
+}
+
+bool parseSwitch(const std::string& value, const std::string& name)
+{
+	if (value == "on" || value == "1")
+	{
+		return true;
+	}
+
+	if (value == "off" || value == "0")
+	{
+		return false;
+	}
+
+	throw std::invalid_argument("Parameter " + name + " must be 'on' or 'off'");
+}
+
+bool updatePstate(const Params& params, int numThreads)
+{
+	TraceSpan span("updatePstate", "pstate", params.pstate);
+
 	DWORD eax;
 	DWORD edx;
-	Rdmsr(PowerState::getRegister(params.pstate), &eax, &edx);
+	{
+		TraceSpan readSpan("Rdmsr", "register", PowerState::getRegister(params.pstate));
+		Rdmsr(PowerState::getRegister(params.pstate), &eax, &edx);
+	}
 
 	uint64_t pstateVal = eax | ((uint64_t)edx << 32);
 	PowerState powerState(params.pstate, pstateVal);
@@ -204,60 +1562,104 @@ void updatePstate(const Params& params, int numThreads)
 	powerState.print();
 	std::cout << "--------------------------------------------------" << std::endl;
 
-	if (!params.dryRun) {
-		applyPstate(powerState, numThreads);
+	// known bad definitions are refused before they reach the hardware, a dry run only reports
+	CertificationDatabase certifications(params.certificationDatabase, readCpuIdentity());
+	checkCertification(certifications, powerState, params.force || params.dryRun);
+
+	if (params.dryRun) {
+		return false;
 	}
+
+	return applyPstate(powerState, numThreads);
 }
 
-void applyPstate(const PowerState& powerState, int numThreads)
+bool applyPstate(const PowerState& powerState, int numThreads)
 {
-	uint64_t pstateVal = powerState.getValue();
-	DWORD eax = pstateVal & 0xFFFFFFFF;
-	DWORD edx = pstateVal >> 32;
+	return applyPstates({ powerState }, numThreads);
+}
+
+bool applyPstates(const std::vector<PowerState>& powerStates, int numThreads)
+{
+	TraceSpan span("applyPstates", "count", powerStates.size());
 
 	// according to register reference, this msr needs to be set for every thread
-	// we create a thread affinity mask for all the threads on the system, and then
-	// loop and set the msr with a separate mask for each individual thread
-	DWORD_PTR maxMask = -1; // initialize all bits to one
+	// we read the current value on all threads in parallel first, and only write
+	// the threads that differ, so rerunning with the same settings doesn't touch anything
+	std::vector<std::vector<uint64_t>> currentValues;
+	bool changesP0 = false;
+	for (const PowerState& powerState : powerStates)
+	{
+		currentValues.push_back(readMsrOnAllThreads(powerState.getRegister(), numThreads));
+		for (uint64_t value : currentValues.back())
+		{
+			changesP0 |= powerState.getPstate() == 0 && value != powerState.getValue();
+		}
+	}
 
-	// shift bits to represent actual number of threads in system
-	maxMask = maxMask >> (sizeof(DWORD_PTR) * 8 - numThreads);
+	std::vector<int> changedThreads;
+	for (int thread = 0; thread < numThreads; thread++)
+	{
+		for (size_t i = 0; i < powerStates.size(); i++)
+		{
+			if (currentValues[i][thread] != powerStates[i].getValue())
+			{
+				changedThreads.push_back(thread);
+				break;
+			}
+		}
+	}
 
-	// affinity mask for one thread each
-	DWORD_PTR mask = 0x1;
+	if (changedThreads.empty())
+	{
+		std::cout << "Pstate already set on all " << numThreads << " threads, no change" << std::endl;
+		return false;
+	}
 
 	// if we change pstate 0, we have to lock the TSC frequency, otherwise
 	// the system will get very confused and unstable
-	if (powerState.getPstate() == 0)
+	TscCheckOptions tscCheckOptions;
+	if (changesP0)
 	{
+		// the TSC rate must not change with the new P0 frequency, so we remember the current one
+		tscCheckOptions.expectedHz = calibrateTscFrequency();
+
 		std::cout << "Info: TSC frequency will be locked to current pstate 0 frequency "
 			"to avoid issues" << std::endl;
-		while (mask < maxMask) {
-			lockTsc(mask);
-			mask = mask << 1;
+
+		// HWCR is only written on threads that don't have the lock bit set yet
+		for (int thread = 0; thread < numThreads; thread++)
+		{
+			lockTsc((DWORD_PTR)1 << thread);
 		}
-		mask = 0x1;
 	}
 
-	while (mask < maxMask) {
-		WrmsrTx(powerState.getRegister(), eax, edx, mask);
-		mask = mask << 1;
+	// one pass over the threads, every thread gets all of its changed definitions at once
+	for (int thread : changedThreads)
+	{
+		TraceSpan threadSpan("writePstate", "thread", thread);
+		for (size_t i = 0; i < powerStates.size(); i++)
+		{
+			if (currentValues[i][thread] != powerStates[i].getValue())
+			{
+				writeMsr(powerStates[i].getRegister(), powerStates[i].getValue(), (DWORD_PTR)1 << thread);
+			}
+		}
 	}
 
-	std::cout << "Pstate updated" << std::endl;
-}
+	std::cout << "Pstate updated on " << changedThreads.size() << " of " << numThreads << " threads" << std::endl;
 
-void lockTsc(DWORD_PTR mask)
-{
-	DWORD eax;
-	DWORD edx;
-	RdmsrTx(HWCONF_REGISTER, &eax, &edx, mask);
-	eax = eax | (1 << 21); // set bit 21 (LockTscToCurrentP0) to true
-	WrmsrTx(HWCONF_REGISTER, eax, edx, mask);
+	if (changesP0)
+	{
+		std::cout << "Verifying TSC after pstate 0 change..." << std::endl;
+		verifyTsc(numThreads, tscCheckOptions);
+	}
+
+	return true;
 }
 
 int getNumberOfHardwareThreads()
 {
+	TraceSpan span("getNumberOfHardwareThreads");
 	int numHardwareThreads = std::thread::hardware_concurrency();
 
 	if (numHardwareThreads == 0)
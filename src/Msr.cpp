@@ -0,0 +1,113 @@
+﻿#include "Msr.h"
+
+#include <exception>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include "lib/OlsApi.h"
+#include "Trace.h"
+
+uint64_t readMsr(unsigned int reg, DWORD_PTR mask)
+{
+	TraceSpan span("RdmsrTx", "mask", mask);
+	DWORD eax;
+	DWORD edx;
+
+	if (!RdmsrTx(reg, &eax, &edx, mask))
+	{
+		std::ostringstream errorMessage;
+		errorMessage << "Failed to read MSR 0x" << std::hex << std::uppercase << reg
+			<< " (thread mask 0x" << mask << ")";
+		throw std::runtime_error(errorMessage.str());
+	}
+
+	return eax | ((uint64_t)edx << 32);
+}
+
+void writeMsr(unsigned int reg, uint64_t value, DWORD_PTR mask)
+{
+	TraceSpan span("WrmsrTx", "mask", mask);
+	DWORD eax = value & 0xFFFFFFFF;
+	DWORD edx = value >> 32;
+
+	if (!WrmsrTx(reg, eax, edx, mask))
+	{
+		std::ostringstream errorMessage;
+		errorMessage << "Failed to write MSR 0x" << std::hex << std::uppercase << reg
+			<< " (thread mask 0x" << mask << ")";
+		throw std::runtime_error(errorMessage.str());
+	}
+}
+
+std::vector<uint64_t> readMsrOnAllThreads(unsigned int reg, int numThreads)
+{
+	TraceSpan span("readMsrOnAllThreads", "register", reg);
+	std::vector<uint64_t> values(numThreads);
+	std::vector<std::exception_ptr> errors(numThreads);
+	std::vector<std::thread> workers;
+
+	for (int thread = 0; thread < numThreads; thread++)
+	{
+		workers.emplace_back([&, thread]() {
+			try
+			{
+				values[thread] = readMsr(reg, (DWORD_PTR)1 << thread);
+			}
+			catch (...)
+			{
+				errors[thread] = std::current_exception();
+			}
+		});
+	}
+
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+
+	for (const std::exception_ptr& error : errors)
+	{
+		if (error)
+		{
+			std::rethrow_exception(error);
+		}
+	}
+
+	return values;
+}
+
+void writeMsrOnAllThreads(unsigned int reg, const std::vector<uint64_t>& values)
+{
+	TraceSpan span("writeMsrOnAllThreads", "register", reg);
+	int numThreads = (int)values.size();
+	std::vector<std::exception_ptr> errors(numThreads);
+	std::vector<std::thread> workers;
+
+	for (int thread = 0; thread < numThreads; thread++)
+	{
+		workers.emplace_back([&, thread]() {
+			try
+			{
+				writeMsr(reg, values[thread], (DWORD_PTR)1 << thread);
+			}
+			catch (...)
+			{
+				errors[thread] = std::current_exception();
+			}
+		});
+	}
+
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+
+	for (const std::exception_ptr& error : errors)
+	{
+		if (error)
+		{
+			std::rethrow_exception(error);
+		}
+	}
+}
@@ -0,0 +1,18 @@
+﻿#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <Windows.h>
+
+// read and write a model specific register on the thread(s) selected by the affinity mask
+// throws std::runtime_error if WinRing0 reports a failure
+uint64_t readMsr(unsigned int reg, DWORD_PTR mask);
+void writeMsr(unsigned int reg, uint64_t value, DWORD_PTR mask);
+
+// reads a model specific register on every hardware thread at the same time,
+// one worker per thread, the result is indexed by thread number
+std::vector<uint64_t> readMsrOnAllThreads(unsigned int reg, int numThreads);
+
+// writes a model specific register on every hardware thread at the same time, the value of
+// each thread is taken from the vector indexed by thread number
+void writeMsrOnAllThreads(unsigned int reg, const std::vector<uint64_t>& values);
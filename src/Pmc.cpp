@@ -0,0 +1,178 @@
+﻿#include "Pmc.h"
+
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include "lib/OlsApi.h"
+#include "CpuStatus.h"
+#include "Msr.h"
+#include "Threads.h"
+#include "Trace.h"
+
+// constants
+// PERF_CTL[22] En, [17] OS, [16] USR
+static constexpr uint64_t PERF_CTL_ENABLE{ (1 << 22) | (1 << 17) | (1 << 16) };
+
+PerformanceCounters::PerformanceCounters(DWORD_PTR mask)
+	:threads(getThreadsInMask(mask))
+{
+	int numSaved = 0;
+
+	try
+	{
+		for (int thread : threads)
+		{
+			DWORD_PTR threadMask = (DWORD_PTR)1 << thread;
+			savedControls.emplace_back();
+			numSaved = 0;
+
+			for (int i = 0; i < NUM_EVENTS; i++)
+			{
+				unsigned int controlRegister = PERF_CTL_REGISTER + 2 * i;
+				savedControls.back()[i] = readMsr(controlRegister, threadMask);
+				numSaved = i + 1;
+
+				// [7:0] event select, [15:8] unit mask, event select [11:8] would go to [35:32]
+				uint64_t control = EVENT_CODES[i] | PERF_CTL_ENABLE;
+				writeMsr(controlRegister, control, threadMask);
+			}
+		}
+	}
+	catch (...)
+	{
+		// the destructor doesn't run for a failed constructor, the counters programmed so far are restored here
+		for (size_t i = 0; i < savedControls.size(); i++)
+		{
+			restoreControls(threads[i], savedControls[i], i + 1 < savedControls.size() ? NUM_EVENTS : numSaved);
+		}
+		throw;
+	}
+}
+
+PerformanceCounters::~PerformanceCounters()
+{
+	for (size_t i = 0; i < threads.size(); i++)
+	{
+		restoreControls(threads[i], savedControls[i], NUM_EVENTS);
+	}
+}
+
+void PerformanceCounters::restoreControls(int thread, const Values& saved, int numEvents)
+{
+	for (int event = 0; event < numEvents; event++)
+	{
+		// used by the destructor, so it must not throw, at worst the counter keeps our configuration
+		DWORD eax = saved[event] & 0xFFFFFFFF;
+		DWORD edx = saved[event] >> 32;
+		WrmsrTx(PERF_CTL_REGISTER + 2 * event, eax, edx, (DWORD_PTR)1 << thread);
+	}
+}
+
+PerformanceCounters::Values PerformanceCounters::read(int thread) const
+{
+	Values values;
+
+	for (int i = 0; i < NUM_EVENTS; i++)
+	{
+		DWORD eax;
+		DWORD edx;
+
+		// RDPMC index n reads PERF_CTRn
+		if (!RdpmcTx(i, &eax, &edx, (DWORD_PTR)1 << thread))
+		{
+			std::ostringstream errorMessage;
+			errorMessage << "Failed to read performance counter " << i << " on thread " << thread;
+			throw std::runtime_error(errorMessage.str());
+		}
+
+		values[i] = eax | ((uint64_t)edx << 32);
+	}
+
+	return values;
+}
+
+PerformanceCounters::Values PerformanceCounters::delta(const Values& before, const Values& after)
+{
+	Values values;
+
+	for (int i = 0; i < NUM_EVENTS; i++)
+	{
+		values[i] = (after[i] - before[i]) & COUNTER_MASK;
+	}
+
+	return values;
+}
+
+std::array<PstateCounterTotals, 8> samplePmcPerPstate(DWORD_PTR mask, DWORD durationMs, DWORD intervalMs)
+{
+	TraceSpan span("samplePmcPerPstate", "mask", mask);
+
+	std::array<PstateCounterTotals, 8> totals{};
+	std::vector<int> threads = getThreadsInMask(mask);
+	PerformanceCounters counters(mask);
+
+	std::vector<PerformanceCounters::Values> previous;
+	for (int thread : threads)
+	{
+		previous.push_back(counters.read(thread));
+	}
+
+	for (DWORD elapsed = 0; elapsed < durationMs; elapsed += intervalMs)
+	{
+		Sleep(intervalMs);
+
+		for (size_t i = 0; i < threads.size(); i++)
+		{
+			PerformanceCounters::Values current = counters.read(threads[i]);
+			int pstate = readCurrentPstate((DWORD_PTR)1 << threads[i]);
+			PerformanceCounters::Values delta = PerformanceCounters::delta(previous[i], current);
+
+			totals[pstate].samples++;
+			for (int event = 0; event < PerformanceCounters::NUM_EVENTS; event++)
+			{
+				totals[pstate].values[event] += delta[event];
+			}
+
+			previous[i] = current;
+		}
+	}
+
+	return totals;
+}
+
+void printPmcReport(const std::array<PstateCounterTotals, 8>& totals)
+{
+	std::cout << std::left << std::setw(8) << "Pstate"
+		<< std::setw(10) << "Samples"
+		<< std::setw(8) << "IPC"
+		<< std::setw(14) << "L2 MPKI"
+		<< std::setw(14) << "DRAM MPKI"
+		<< std::setw(14) << "Stall FE %"
+		<< std::setw(14) << "Stall BE %" << std::endl;
+
+	for (int pstate = 0; pstate < 8; pstate++)
+	{
+		const PstateCounterTotals& total = totals[pstate];
+		if (!total.samples)
+		{
+			continue;
+		}
+
+		double instructions = (double)total.values[PerformanceCounters::INSTRUCTIONS];
+		double cycles = (double)total.values[PerformanceCounters::CYCLES];
+		double kiloInstructions = instructions / 1000;
+
+		std::cout << std::left << std::setw(8) << pstate
+			<< std::setw(10) << total.samples << std::fixed << std::setprecision(2)
+			<< std::setw(8) << (cycles ? instructions / cycles : 0)
+			<< std::setw(14) << (kiloInstructions ? total.values[PerformanceCounters::L2_MISSES] / kiloInstructions : 0)
+			<< std::setw(14) << (kiloInstructions ? total.values[PerformanceCounters::DRAM_REFILLS] / kiloInstructions : 0)
+			<< std::setw(14) << (cycles ? total.values[PerformanceCounters::STALLED_CYCLES_FRONTEND] * 100 / cycles : 0)
+			<< std::setw(14) << (cycles ? total.values[PerformanceCounters::STALLED_CYCLES_BACKEND] * 100 / cycles : 0)
+			<< std::endl;
+	}
+
+	std::cout << std::defaultfloat << std::right;
+}
@@ -0,0 +1,73 @@
+﻿#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include <Windows.h>
+
+// core performance counters (PERF_CTL/PERF_CTR 0-5), programmed with a fixed event set
+class PerformanceCounters
+{
+public:
+	enum Event
+	{
+		INSTRUCTIONS,
+		CYCLES,
+		L2_MISSES,
+		DRAM_REFILLS, // data cache refills from DRAM, i.e. L3 misses of loads
+		STALLED_CYCLES_FRONTEND,
+		STALLED_CYCLES_BACKEND,
+		NUM_EVENTS
+	};
+
+	using Values = std::array<uint64_t, NUM_EVENTS>;
+
+	// programs the counters on every thread in the mask, the previous configuration is saved
+	explicit PerformanceCounters(DWORD_PTR mask);
+
+	// restores the saved counter configuration
+	virtual ~PerformanceCounters();
+
+	PerformanceCounters(const PerformanceCounters&) = delete;
+	PerformanceCounters& operator=(const PerformanceCounters&) = delete;
+
+	// reads all counters of a thread with RDPMC
+	Values read(int thread) const;
+
+	// difference between two reads, taking the 48 bit counter width into account
+	static Values delta(const Values& before, const Values& after);
+
+private:
+	std::vector<int> threads;
+	std::vector<std::array<uint64_t, NUM_EVENTS>> savedControls;
+
+	static constexpr unsigned int PERF_CTL_REGISTER{ 0xC0010200 }; // PERF_CTLn = 0xC0010200 + 2n, read through RDPMC n
+	static constexpr uint64_t COUNTER_MASK{ ((uint64_t)1 << 48) - 1 };
+
+	// event select and unit mask for every event, same encoding as the perf events of linux
+	static constexpr uint16_t EVENT_CODES[NUM_EVENTS]
+	{
+		0x00C0, // ExRetInstr
+		0x0076, // LsNotHaltedCyc
+		0x0964, // L2CacheReqStat, instruction and data cache misses in L2
+		0x4843, // LsRefillsFromSys, local and remote DRAM
+		0x0287, // IcFetchStall, IcStallDqEmpty: the decode queue ran empty (stalled-cycles-frontend of perf)
+		0x0187, // IcFetchStall, IcStallBackPressure: fetch held back by the backend
+	};
+
+	// writes back the first numEvents saved controls of a thread, never throws
+	static void restoreControls(int thread, const Values& saved, int numEvents);
+};
+
+struct PstateCounterTotals
+{
+	uint64_t samples{ 0 };
+	PerformanceCounters::Values values{};
+};
+
+// samples the counters and the current pstate of every thread in the mask periodically and
+// attributes each counter delta to the pstate the thread was in at the end of the interval
+std::array<PstateCounterTotals, 8> samplePmcPerPstate(DWORD_PTR mask, DWORD durationMs, DWORD intervalMs);
+
+// prints IPC, misses per thousand instructions and stall ratio per pstate
+void printPmcReport(const std::array<PstateCounterTotals, 8>& totals);
@@ -0,0 +1,311 @@
+﻿#include "PowerBudget.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#include "Sampler.h"
+#include "Smn.h"
+#include "Stress.h"
+#include "Threads.h"
+#include "Trace.h"
+
+// constants
+static constexpr DWORD WARMUP_MS{ 1000 };
+static constexpr DWORD STRESS_TAIL_MS{ 500 };
+static constexpr double POWER_RESOLUTION_WATTS{ 0.1 };
+
+// prototypes
+static double getFastestFrequency(const BudgetCalibration& calibration);
+static double getGroupWatts(const BudgetCalibration& calibration, const CoreGroup& group, size_t point);
+static double getGroupThroughput(const BudgetCalibration& calibration, const CoreGroup& group, size_t point,
+	double fastestMhz, double sensitivity);
+
+PointMeasurement measureOperatingPoint(const std::vector<CoreInfo>& cores, int numThreads, DWORD durationMs)
+{
+	TraceSpan span("measureOperatingPoint");
+
+	PciSmnAccess smn;
+	Sampler sampler(numThreads, smn);
+	Stress stress(getAllThreadsMask(numThreads), WARMUP_MS + durationMs + STRESS_TAIL_MS);
+
+	// the first sample only skips the ramp up and the first temperature rise
+	Sleep(WARMUP_MS);
+	sampler.sample();
+	Sleep(durationMs);
+	const SystemSample& sample = sampler.sample();
+
+	PointMeasurement measurement;
+	double coreWatts = 0;
+	for (const CoreInfo& core : cores)
+	{
+		std::vector<int> threads = getThreadsInMask(core.threadMask);
+
+		CoreMeasurement coreMeasurement;
+		for (int thread : threads)
+		{
+			coreMeasurement.frequencyMhz += sample.cpus[thread].frequencyMhz / threads.size();
+		}
+
+		// all threads of a core read the same core energy counter
+		coreMeasurement.powerWatts = sample.cpus[threads.front()].corePowerWatts;
+		coreWatts += coreMeasurement.powerWatts;
+		measurement.cores.push_back(coreMeasurement);
+	}
+	measurement.uncoreWatts = std::max(sample.packagePowerWatts - coreWatts, 0.0);
+
+	stress.wait(INFINITE);
+	if (!stress.isStable())
+	{
+		throw std::runtime_error("The stress computed a wrong result, the operating point is not stable");
+	}
+
+	return measurement;
+}
+
+void saveBudgetCalibration(const std::string& path, const BudgetCalibration& calibration)
+{
+	std::ofstream file(path);
+	if (!file)
+	{
+		throw std::runtime_error("Failed to create power budget calibration '" + path + "'");
+	}
+
+	// one line per operating point: name fid did vid uncoreWatts, then mhz watts for every core
+	file << "# ryzen_pstates power budget calibration\n";
+	for (size_t i = 0; i < calibration.points.size(); i++)
+	{
+		const OperatingPoint& point = calibration.points[i];
+		const PointMeasurement& measurement = calibration.measurements[i];
+
+		file << point.name << " " << +point.fid << " " << +point.did << " " << +point.vid << " " << measurement.uncoreWatts;
+		for (const CoreMeasurement& core : measurement.cores)
+		{
+			file << " " << core.frequencyMhz << " " << core.powerWatts;
+		}
+		file << "\n";
+	}
+
+	if (!file.flush())
+	{
+		throw std::runtime_error("Failed to write power budget calibration '" + path + "'");
+	}
+}
+
+BudgetCalibration loadBudgetCalibration(const std::string& path, size_t numCores)
+{
+	std::ifstream file(path);
+	if (!file)
+	{
+		throw std::runtime_error("No power budget calibration in '" + path + "', run with --calibrate first");
+	}
+
+	BudgetCalibration calibration;
+	std::string line;
+	while (std::getline(file, line))
+	{
+		if (line.empty() || line[0] == '#')
+		{
+			continue;
+		}
+
+		std::istringstream fields(line);
+		OperatingPoint point;
+		unsigned int fid;
+		unsigned int did;
+		unsigned int vid;
+		PointMeasurement measurement;
+		fields >> point.name >> fid >> did >> vid >> measurement.uncoreWatts;
+
+		CoreMeasurement core;
+		while (fields >> core.frequencyMhz >> core.powerWatts)
+		{
+			measurement.cores.push_back(core);
+		}
+
+		if (point.name.empty() || measurement.cores.size() != numCores)
+		{
+			throw std::runtime_error("Power budget calibration '" + path + "' doesn't match this CPU, run with --calibrate");
+		}
+
+		point.fid = (uint8_t)fid;
+		point.did = (uint8_t)did;
+		point.vid = (uint8_t)vid;
+		calibration.points.push_back(point);
+		calibration.measurements.push_back(measurement);
+	}
+
+	if (calibration.points.empty())
+	{
+		throw std::runtime_error("Power budget calibration '" + path + "' is empty, run with --calibrate");
+	}
+
+	return calibration;
+}
+
+std::vector<CoreGroup> groupCores(const std::vector<CoreInfo>& cores, bool byCcx)
+{
+	std::vector<CoreGroup> groups;
+	for (size_t i = 0; i < cores.size(); i++)
+	{
+		auto group = std::find_if(groups.begin(), groups.end(), [&](const CoreGroup& existing) {
+			return byCcx && cores[existing.front()].ccx == cores[i].ccx;
+		});
+
+		if (group == groups.end())
+		{
+			groups.push_back({ (int)i });
+		}
+		else
+		{
+			group->push_back((int)i);
+		}
+	}
+
+	return groups;
+}
+
+BudgetAllocation allocatePowerBudget(const BudgetCalibration& calibration, const std::vector<CoreGroup>& groups,
+	double budgetWatts, double sensitivity)
+{
+	TraceSpan span("allocatePowerBudget");
+
+	// the uncore power hardly depends on the core clocks, the highest measured value is the safe one
+	double uncoreWatts = 0;
+	for (const PointMeasurement& measurement : calibration.measurements)
+	{
+		uncoreWatts = std::max(uncoreWatts, measurement.uncoreWatts);
+	}
+
+	int steps = (int)std::floor((budgetWatts - uncoreWatts) / POWER_RESOLUTION_WATTS);
+	if (steps < 0)
+	{
+		throw std::invalid_argument("The budget doesn't even cover the uncore power");
+	}
+
+	double fastestMhz = getFastestFrequency(calibration);
+	size_t numPoints = calibration.points.size();
+	const double impossible = -std::numeric_limits<double>::infinity();
+
+	// best[b]: highest throughput of the groups so far with at most b power steps,
+	// choice[g][b]: the point group g gets in that solution
+	std::vector<double> best(steps + 1, 0);
+	std::vector<std::vector<int>> choice(groups.size(), std::vector<int>(steps + 1, -1));
+
+	for (size_t g = 0; g < groups.size(); g++)
+	{
+		std::vector<double> next(steps + 1, impossible);
+		for (size_t p = 0; p < numPoints; p++)
+		{
+			// rounded up, the prediction never underestimates the power
+			int cost = (int)std::ceil(getGroupWatts(calibration, groups[g], p) / POWER_RESOLUTION_WATTS);
+			double throughput = getGroupThroughput(calibration, groups[g], p, fastestMhz, sensitivity);
+
+			for (int b = cost; b <= steps; b++)
+			{
+				if (best[b - cost] != impossible && best[b - cost] + throughput > next[b])
+				{
+					next[b] = best[b - cost] + throughput;
+					choice[g][b] = (int)p;
+				}
+			}
+		}
+		best.swap(next);
+	}
+
+	if (best[steps] == impossible)
+	{
+		throw std::invalid_argument("The budget is too low even for the slowest operating point on every core");
+	}
+
+	// walk back through the choices
+	BudgetAllocation allocation;
+	allocation.pointOfGroup.resize(groups.size());
+	allocation.throughput = best[steps];
+	allocation.watts = uncoreWatts;
+
+	int remaining = steps;
+	for (size_t g = groups.size(); g-- > 0;)
+	{
+		size_t point = (size_t)choice[g][remaining];
+		allocation.pointOfGroup[g] = point;
+		allocation.watts += getGroupWatts(calibration, groups[g], point);
+		remaining -= (int)std::ceil(getGroupWatts(calibration, groups[g], point) / POWER_RESOLUTION_WATTS);
+	}
+
+	return allocation;
+}
+
+void printBudgetAllocation(const BudgetCalibration& calibration, const std::vector<CoreGroup>& groups,
+	const BudgetAllocation& allocation, double budgetWatts)
+{
+	std::streamsize precision = std::cout.precision();
+	std::cout << std::left << std::setw(16) << "Cores" << std::setw(8) << "Point" << std::setw(6) << "FID"
+		<< std::setw(6) << "DID" << std::setw(6) << "VID" << std::setw(10) << "MHz" << "Watts" << std::endl;
+	std::cout << std::fixed << std::setprecision(1);
+
+	for (size_t g = 0; g < groups.size(); g++)
+	{
+		size_t point = allocation.pointOfGroup[g];
+		const OperatingPoint& operatingPoint = calibration.points[point];
+
+		std::ostringstream cores;
+		double mhz = 0;
+		for (int core : groups[g])
+		{
+			cores << (cores.tellp() > 0 ? "," : "") << core;
+			mhz += calibration.measurements[point].cores[core].frequencyMhz / groups[g].size();
+		}
+
+		std::cout << std::setw(16) << cores.str() << std::setw(8) << operatingPoint.name
+			<< std::setw(6) << +operatingPoint.fid << std::setw(6) << +operatingPoint.did << std::setw(6) << +operatingPoint.vid
+			<< std::setw(10) << mhz << getGroupWatts(calibration, groups[g], point) << std::endl;
+	}
+
+	std::cout << "Predicted package power: " << allocation.watts << " of " << budgetWatts << " W, throughput "
+		<< std::setprecision(2) << allocation.throughput << " core equivalents" << std::endl;
+	std::cout << std::defaultfloat << std::setprecision(precision) << std::right;
+}
+
+static double getFastestFrequency(const BudgetCalibration& calibration)
+{
+	double fastest = 0;
+	for (const PointMeasurement& measurement : calibration.measurements)
+	{
+		for (const CoreMeasurement& core : measurement.cores)
+		{
+			fastest = std::max(fastest, core.frequencyMhz);
+		}
+	}
+
+	return fastest;
+}
+
+static double getGroupWatts(const BudgetCalibration& calibration, const CoreGroup& group, size_t point)
+{
+	double watts = 0;
+	for (int core : group)
+	{
+		watts += calibration.measurements[point].cores[core].powerWatts;
+	}
+
+	return watts;
+}
+
+static double getGroupThroughput(const BudgetCalibration& calibration, const CoreGroup& group, size_t point,
+	double fastestMhz, double sensitivity)
+{
+	double throughput = 0;
+	for (int core : group)
+	{
+		double mhz = calibration.measurements[point].cores[core].frequencyMhz;
+		throughput += fastestMhz > 0 ? std::pow(mhz / fastestMhz, sensitivity) : 0;
+	}
+
+	return throughput;
+}
@@ -0,0 +1,60 @@
+﻿#pragma once
+#include <string>
+#include <vector>
+
+#include <Windows.h>
+
+#include "Sensitivity.h"
+#include "Topology.h"
+
+// behaviour of one core at one operating point while all threads run the stress
+struct CoreMeasurement
+{
+	double frequencyMhz{ 0 }; // effective frequency, average of the threads of the core
+	double powerWatts{ 0 }; // core power from the RAPL core energy counter
+};
+
+struct PointMeasurement
+{
+	std::vector<CoreMeasurement> cores; // indexed like getCores
+	double uncoreWatts{ 0 }; // package power not attributed to any core
+};
+
+// per core frequency and power for every candidate operating point
+struct BudgetCalibration
+{
+	std::vector<OperatingPoint> points;
+	std::vector<PointMeasurement> measurements; // indexed like points
+};
+
+// a set of cores that always runs at the same operating point, a single core or a whole CCX
+using CoreGroup = std::vector<int>;
+
+struct BudgetAllocation
+{
+	std::vector<size_t> pointOfGroup; // index into the calibration points for every group
+	double watts{ 0 }; // predicted package power
+	double throughput{ 0 }; // predicted throughput, 1.0 per core at the fastest measured clock
+};
+
+// stresses all threads at the operating point that is currently applied as pstate 0 and
+// measures every core. throws if the stress computed a wrong result
+PointMeasurement measureOperatingPoint(const std::vector<CoreInfo>& cores, int numThreads, DWORD durationMs);
+
+void saveBudgetCalibration(const std::string& path, const BudgetCalibration& calibration);
+
+// throws if the file is missing or was calibrated with a different number of cores
+BudgetCalibration loadBudgetCalibration(const std::string& path, size_t numCores);
+
+std::vector<CoreGroup> groupCores(const std::vector<CoreInfo>& cores, bool byCcx);
+
+// picks one operating point per group that maximizes the total throughput within the package
+// power budget. the throughput of a core scales with its measured clock to the power of the
+// sensitivity (1.0: runtime scales with the clock, 0.0: it doesn't depend on it, see profile).
+// the power is discretized in steps of 0.1 W and the allocation solved exactly by dynamic
+// programming over the groups. throws if even the slowest point exceeds the budget
+BudgetAllocation allocatePowerBudget(const BudgetCalibration& calibration, const std::vector<CoreGroup>& groups,
+	double budgetWatts, double sensitivity);
+
+void printBudgetAllocation(const BudgetCalibration& calibration, const std::vector<CoreGroup>& groups,
+	const BudgetAllocation& allocation, double budgetWatts);
@@ -1,5 +1,6 @@
 ﻿#include "PowerState.h"
 
+#include <cmath>
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
@@ -77,6 +78,12 @@ double PowerState::calculateVcore(uint8_t vid)
 	return 1.55 - (0.00625 * vid);
 }
 
+int PowerState::calculateVid(double vcore)
+{
+	// rounded down to the next VID step, a lower VID is a higher voltage
+	return (int)std::floor((1.55 - vcore) / 0.00625 + 1e-9);
+}
+
 double PowerState::calculateFrequency() const
 {
 	return calculateRatio() * 100;
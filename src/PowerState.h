@@ -18,6 +18,8 @@ public:
 	static double calculateRatio(uint8_t fid, uint8_t did);
 	double calculateVcore() const;
 	static double calculateVcore(uint8_t vid);
+	// VID with a voltage of at least vcore, may be out of the VID limits
+	static int calculateVid(double vcore);
 	double calculateFrequency() const;
 	static double calculateFrequency(uint8_t fid, uint8_t did);
 
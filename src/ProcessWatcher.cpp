@@ -0,0 +1,306 @@
+﻿#include "ProcessWatcher.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cwctype>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+#include <TlHelp32.h>
+
+#include "Msr.h"
+#include "StopSignal.h"
+#include "Threads.h"
+#include "Trace.h"
+#include "Tsc.h"
+#include "TscCheck.h"
+
+struct RegisterWrite
+{
+	unsigned int reg;
+	uint64_t value;
+};
+
+// everything needed to switch a thread to or from a profile, decoded ahead of time
+struct PreparedProfile
+{
+	std::wstring processName;
+	std::vector<RegisterWrite> targetWrites;
+	std::vector<RegisterWrite> restoreWrites;
+	bool changesP0{ false };
+};
+
+struct ActiveProcess
+{
+	size_t profile;
+	DWORD_PTR mask;
+};
+
+// prototypes
+static std::vector<PreparedProfile> prepareProfiles(const std::vector<ProcessBinding>& bindings,
+	const CertificationDatabase& certifications, bool force);
+static std::map<DWORD, size_t> findBoundProcesses(const std::vector<PreparedProfile>& profiles);
+static DWORD_PTR getProcessMask(DWORD pid, DWORD_PTR allThreadsMask);
+static void writeRegisters(const std::vector<RegisterWrite>& writes, DWORD_PTR mask);
+static std::wstring toLower(std::wstring str);
+
+std::vector<ProcessBinding> parseBindings(const std::string& spec)
+{
+	std::vector<ProcessBinding> bindings;
+	std::istringstream specStream(spec);
+	std::string entry;
+
+	while (std::getline(specStream, entry, ';'))
+	{
+		size_t separator = entry.find('=');
+		if (separator == std::string::npos || separator == 0)
+		{
+			throw std::invalid_argument("Binding '" + entry + "' must have the form name.exe=profile");
+		}
+
+		ProcessBinding binding;
+		binding.processName = entry.substr(0, separator);
+		binding.edits = parseProfile(entry.substr(separator + 1));
+		bindings.push_back(binding);
+	}
+
+	if (bindings.empty())
+	{
+		throw std::invalid_argument("No process bindings given");
+	}
+
+	return bindings;
+}
+
+void watchProcesses(const std::vector<ProcessBinding>& bindings, const CertificationDatabase& certifications,
+	bool force, int numThreads, DWORD pollIntervalMs)
+{
+	std::vector<PreparedProfile> profiles = prepareProfiles(bindings, certifications, force);
+	DWORD_PTR allThreadsMask = getAllThreadsMask(numThreads);
+	std::map<DWORD, ActiveProcess> active;
+
+	// like applyPstates: the TSC rate must not change with a new P0 frequency. it is measured and
+	// locked once here (the TSC is shared), so a switch itself only consists of the MSR writes
+	TscCheckOptions tscCheckOptions;
+	if (std::any_of(profiles.begin(), profiles.end(), [](const PreparedProfile& profile) { return profile.changesP0; }))
+	{
+		tscCheckOptions.expectedHz = calibrateTscFrequency();
+		for (int thread = 0; thread < numThreads; thread++)
+		{
+			lockTsc((DWORD_PTR)1 << thread);
+		}
+	}
+
+	installStopHandler();
+	std::cout << "Watching for " << profiles.size() << " process(es), press Ctrl+C to stop" << std::endl;
+
+	// the restore below has to run even if polling or a write fails, or the profiles stay applied
+	std::exception_ptr error;
+	try
+	{
+		while (!isStopRequested())
+		{
+			std::map<DWORD, size_t> running = findBoundProcesses(profiles);
+			bool switchedP0 = false;
+
+			// processes that exited: restore all of their threads, then reapply the other profiles on
+			// shared threads. the profiles may edit different pstates, so the shared threads need both
+			for (auto it = active.begin(); it != active.end();)
+			{
+				if (running.count(it->first))
+				{
+					++it;
+					continue;
+				}
+
+				auto start = std::chrono::steady_clock::now();
+				// a process only leaves the active list once it is restored, so a failed write is retried at the end
+				const ActiveProcess exited = it->second;
+				writeRegisters(profiles[exited.profile].restoreWrites, exited.mask);
+				switchedP0 |= profiles[exited.profile].changesP0;
+				it = active.erase(it);
+
+				for (const auto& other : active)
+				{
+					DWORD_PTR shared = exited.mask & other.second.mask;
+					if (shared)
+					{
+						const PreparedProfile& otherProfile = profiles[other.second.profile];
+						writeRegisters(otherProfile.targetWrites, shared);
+						switchedP0 |= otherProfile.changesP0;
+					}
+				}
+
+				auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+				std::cout << "Process exited, restored pstates (" << elapsed.count() << " ms)" << std::endl;
+			}
+
+			// processes that started
+			for (const auto& process : running)
+			{
+				if (active.count(process.first))
+				{
+					continue;
+				}
+
+				auto start = std::chrono::steady_clock::now();
+				const PreparedProfile& profile = profiles[process.second];
+				DWORD_PTR mask = getProcessMask(process.first, allThreadsMask);
+
+				active[process.first] = ActiveProcess{ process.second, mask };
+				writeRegisters(profile.targetWrites, mask);
+				switchedP0 |= profile.changesP0;
+
+				auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+				std::cout << "Process " << process.first << " started, applied profile on thread mask 0x"
+					<< std::hex << mask << std::dec << " (" << elapsed.count() << " ms)" << std::endl;
+			}
+
+			// verified once the switches are done, the check takes far longer than the writes
+			if (switchedP0)
+			{
+				verifyTsc(numThreads, tscCheckOptions);
+			}
+
+			Sleep(pollIntervalMs);
+		}
+	}
+	catch (...)
+	{
+		error = std::current_exception();
+	}
+
+	// a failed restore must not keep the other processes from being restored
+	bool restored = true;
+	for (const auto& process : active)
+	{
+		const PreparedProfile& profile = profiles[process.second.profile];
+		try
+		{
+			writeRegisters(profile.restoreWrites, process.second.mask);
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << "Failed to restore the pstates of process " << process.first << ": " << e.what() << std::endl;
+			restored = false;
+		}
+	}
+
+	removeStopHandler();
+
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
+
+	if (!restored)
+	{
+		throw std::runtime_error("Not all pstates could be restored");
+	}
+
+	std::cout << "Stopped watching, pstates restored" << std::endl;
+}
+
+static std::vector<PreparedProfile> prepareProfiles(const std::vector<ProcessBinding>& bindings,
+	const CertificationDatabase& certifications, bool force)
+{
+	std::vector<PreparedProfile> profiles;
+
+	for (const ProcessBinding& binding : bindings)
+	{
+		PreparedProfile profile;
+		profile.processName = toLower(std::wstring(binding.processName.begin(), binding.processName.end()));
+
+		for (const PstateEdit& edit : binding.edits)
+		{
+			PowerState original = readPowerState(edit.pstate);
+			PowerState target = resolveEdit(edit);
+
+			profile.targetWrites.push_back(RegisterWrite{ target.getRegister(), target.getValue() });
+			profile.restoreWrites.push_back(RegisterWrite{ original.getRegister(), original.getValue() });
+			profile.changesP0 |= edit.pstate == 0 && target.getValue() != original.getValue();
+
+			std::cout << binding.processName << ", pstate " << edit.pstate << ":" << std::endl;
+			target.print();
+			// all profiles are checked before watching starts, nothing is written until then
+			checkCertification(certifications, target, force);
+		}
+
+		profiles.push_back(profile);
+	}
+
+	return profiles;
+}
+
+static std::map<DWORD, size_t> findBoundProcesses(const std::vector<PreparedProfile>& profiles)
+{
+	std::map<DWORD, size_t> running;
+
+	HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+	if (snapshot == INVALID_HANDLE_VALUE)
+	{
+		throw std::runtime_error("Failed to take a snapshot of the process list");
+	}
+
+	PROCESSENTRY32W entry;
+	entry.dwSize = sizeof(entry);
+
+	for (BOOL found = Process32FirstW(snapshot, &entry); found; found = Process32NextW(snapshot, &entry))
+	{
+		std::wstring name = toLower(entry.szExeFile);
+
+		// the first matching binding wins
+		for (size_t i = 0; i < profiles.size(); i++)
+		{
+			if (profiles[i].processName == name)
+			{
+				running[entry.th32ProcessID] = i;
+				break;
+			}
+		}
+	}
+
+	CloseHandle(snapshot);
+	return running;
+}
+
+static DWORD_PTR getProcessMask(DWORD pid, DWORD_PTR allThreadsMask)
+{
+	DWORD_PTR processMask = allThreadsMask;
+	DWORD_PTR systemMask;
+
+	HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid);
+	if (process)
+	{
+		if (!GetProcessAffinityMask(process, &processMask, &systemMask))
+		{
+			processMask = allThreadsMask;
+		}
+		CloseHandle(process);
+	}
+
+	// if we are not allowed to query the process, we fall back to all threads
+	return processMask & allThreadsMask;
+}
+
+static void writeRegisters(const std::vector<RegisterWrite>& writes, DWORD_PTR mask)
+{
+	TraceSpan span("writeRegisters", "mask", mask);
+
+	for (int thread : getThreadsInMask(mask))
+	{
+		for (const RegisterWrite& write : writes)
+		{
+			writeMsr(write.reg, write.value, (DWORD_PTR)1 << thread);
+		}
+	}
+}
+
+static std::wstring toLower(std::wstring str)
+{
+	std::transform(str.begin(), str.end(), str.begin(), [](wchar_t c) { return (wchar_t)std::towlower(c); });
+	return str;
+}
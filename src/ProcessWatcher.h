@@ -0,0 +1,25 @@
+﻿#pragma once
+#include <string>
+#include <vector>
+
+#include <Windows.h>
+
+#include "Certification.h"
+#include "Profile.h"
+
+// binds a pstate profile to an executable name (e.g. "game.exe", case insensitive)
+struct ProcessBinding
+{
+	std::string processName;
+	std::vector<PstateEdit> edits;
+};
+
+// parses bindings of the form "name.exe=profile[;name.exe=profile...]", see parseProfile
+std::vector<ProcessBinding> parseBindings(const std::string& spec);
+
+// polls the process list until Ctrl+C is pressed. when a bound process starts, its profile is
+// applied to the threads in its affinity mask, when it exits the previous pstates are restored.
+// all pstate definitions are decoded and checked against the certification database once up
+// front, so a switch only consists of the MSR writes
+void watchProcesses(const std::vector<ProcessBinding>& bindings, const CertificationDatabase& certifications,
+	bool force, int numThreads, DWORD pollIntervalMs);
@@ -0,0 +1,122 @@
+﻿#include "Profile.h"
+
+#include <sstream>
+#include <stdexcept>
+
+#include <Windows.h>
+#include "lib/OlsApi.h"
+
+// prototypes
+static std::optional<unsigned int> parseField(const std::string& field, const std::string& entry);
+
+std::vector<PstateEdit> parseProfile(const std::string& spec)
+{
+	std::vector<PstateEdit> edits;
+	std::istringstream specStream(spec);
+	std::string entry;
+
+	while (std::getline(specStream, entry, ','))
+	{
+		std::istringstream entryStream(entry);
+		std::string fields[4];
+		int numFields = 0;
+
+		while (numFields < 4 && std::getline(entryStream, fields[numFields], ':'))
+		{
+			numFields++;
+		}
+
+		if (numFields != 4 || !entryStream.eof())
+		{
+			throw std::invalid_argument("Profile entry '" + entry + "' must have the form pstate:fid:did:vid");
+		}
+
+		std::optional<unsigned int> pstate = parseField(fields[0], entry);
+		if (!pstate || *pstate > 7)
+		{
+			throw std::invalid_argument("Profile entry '" + entry + "' must select a pstate between 0 and 7");
+		}
+
+		PstateEdit edit;
+		edit.pstate = *pstate;
+		edit.fid = parseField(fields[1], entry);
+		edit.did = parseField(fields[2], entry);
+		edit.vid = parseField(fields[3], entry);
+		edits.push_back(edit);
+	}
+
+	if (edits.empty())
+	{
+		throw std::invalid_argument("Profile is empty");
+	}
+
+	return edits;
+}
+
+PowerState resolveEdit(const PstateEdit& edit)
+{
+	PowerState powerState = readPowerState(edit.pstate);
+
+	if (edit.fid)
+	{
+		powerState.setFid(*edit.fid);
+	}
+
+	if (edit.did)
+	{
+		powerState.setDid(*edit.did);
+	}
+
+	if (edit.vid)
+	{
+		powerState.setVid(*edit.vid);
+	}
+
+	return powerState;
+}
+
+PowerState readPowerState(int pstate)
+{
+	DWORD eax;
+	DWORD edx;
+	Rdmsr(PowerState::getRegister(pstate), &eax, &edx);
+
+	return PowerState(pstate, eax | ((uint64_t)edx << 32));
+}
+
+std::vector<PowerState> readEnabledPowerStates()
+{
+	std::vector<PowerState> powerStates;
+
+	for (int pstate = 0; pstate < 8; pstate++)
+	{
+		DWORD eax;
+		DWORD edx;
+		Rdmsr(PowerState::getRegister(pstate), &eax, &edx);
+
+		// PStateEn, the PowerState constructor refuses disabled pstates
+		if (edx >> 31 & 0x1)
+		{
+			powerStates.emplace_back(pstate, eax | ((uint64_t)edx << 32));
+		}
+	}
+
+	return powerStates;
+}
+
+static std::optional<unsigned int> parseField(const std::string& field, const std::string& entry)
+{
+	if (field == "-")
+	{
+		return std::nullopt;
+	}
+
+	std::istringstream fieldStream(field);
+	unsigned int value;
+	if (!(fieldStream >> value) || !fieldStream.eof())
+	{
+		throw std::invalid_argument("Invalid value '" + field + "' in profile entry '" + entry + "'");
+	}
+
+	return value;
+}
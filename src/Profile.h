@@ -0,0 +1,28 @@
+﻿#pragma once
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "PowerState.h"
+
+// requested change to a single pstate, fields that are not set keep their current value
+struct PstateEdit
+{
+	int pstate{ 0 };
+	std::optional<unsigned int> fid;
+	std::optional<unsigned int> did;
+	std::optional<unsigned int> vid;
+};
+
+// parses a profile of the form "pstate:fid:did:vid[,pstate:fid:did:vid...]"
+// a '-' keeps the current value of a field, e.g. "0:-:-:80,1:90:10:88"
+std::vector<PstateEdit> parseProfile(const std::string& spec);
+
+// reads the current definition of the pstate (from the calling thread) and applies the edit to it
+PowerState resolveEdit(const PstateEdit& edit);
+
+// reads the current definition of a pstate from the calling thread
+PowerState readPowerState(int pstate);
+
+// current definitions of all enabled pstates, ascending by pstate
+std::vector<PowerState> readEnabledPowerStates();
@@ -0,0 +1,201 @@
+﻿#include "PrometheusExporter.h"
+
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+
+#include "Msr.h"
+#include "PowerState.h"
+#include "StopSignal.h"
+#include "Trace.h"
+
+// constants
+static constexpr int NUM_PSTATES{ 8 };
+static constexpr size_t BUFFER_BYTES_PER_THREAD{ 8192 };
+
+static constexpr int NUM_DEFINITION_FAMILIES{ 5 };
+static constexpr const char* DEFINITION_FAMILIES[NUM_DEFINITION_FAMILIES][2]
+{
+	{ "ryzen_pstates_definition_fid", "FID of the pstate definition" },
+	{ "ryzen_pstates_definition_did", "DID of the pstate definition" },
+	{ "ryzen_pstates_definition_vid", "VID of the pstate definition" },
+	{ "ryzen_pstates_definition_frequency_mhz", "Frequency of the pstate definition" },
+	{ "ryzen_pstates_definition_voltage_volts", "VCore of the pstate definition" },
+};
+
+static constexpr const char* PSTATE_LABELS[NUM_PSTATES]
+{
+	"pstate=\"0\"", "pstate=\"1\"", "pstate=\"2\"", "pstate=\"3\"",
+	"pstate=\"4\"", "pstate=\"5\"", "pstate=\"6\"", "pstate=\"7\""
+};
+
+// prototypes
+static bool isEnabled(uint64_t definition);
+
+PrometheusExporter::PrometheusExporter(const std::string& path, int numThreads, const FabricClocks& fabricClocks)
+	:path(path), temporaryPath(path + ".tmp"), numThreads(numThreads), fabricClocks(fabricClocks),
+	definitions((size_t)numThreads * NUM_PSTATES)
+{
+	// the collector only reads *.prom, so the temporary file is ignored until it is renamed
+	std::vector<CoreInfo> cores = getCores(numThreads);
+	for (int thread = 0; thread < numThreads; thread++)
+	{
+		int core = getCoreOfThread(cores, thread);
+		labels.push_back("cpu=\"" + std::to_string(thread) + "\",core=\"" + std::to_string(core)
+			+ "\",ccx=\"" + std::to_string(cores[core].ccx) + "\"");
+	}
+
+	buffer.reserve(BUFFER_BYTES_PER_THREAD * numThreads);
+}
+
+void PrometheusExporter::write(const SystemSample& sample)
+{
+	TraceSpan span("PrometheusExporter::write");
+	readDefinitions();
+	buffer.clear();
+
+	// all samples of a metric family have to follow its TYPE line
+	for (int family = 0; family < NUM_DEFINITION_FAMILIES; family++)
+	{
+		beginFamily(DEFINITION_FAMILIES[family][0], "gauge", DEFINITION_FAMILIES[family][1]);
+		for (int thread = 0; thread < numThreads; thread++)
+		{
+			for (int pstate = 0; pstate < NUM_PSTATES; pstate++)
+			{
+				uint64_t definition = definitions[(size_t)thread * NUM_PSTATES + pstate];
+				if (!isEnabled(definition))
+				{
+					continue;
+				}
+
+				PowerState powerState(pstate, definition);
+				double values[]{ (double)powerState.getFid(), (double)powerState.getDid(), (double)powerState.getVid(),
+					powerState.calculateFrequency(), powerState.calculateVcore() };
+
+				appendValue(DEFINITION_FAMILIES[family][0], labels[thread], PSTATE_LABELS[pstate], values[family]);
+			}
+		}
+	}
+
+	beginFamily("ryzen_pstates_current_pstate", "gauge", "Pstate the thread is running in");
+	for (const CpuSample& cpu : sample.cpus)
+	{
+		appendValue("ryzen_pstates_current_pstate", labels[cpu.cpu], nullptr, cpu.pstate);
+	}
+
+	beginFamily("ryzen_pstates_effective_frequency_mhz", "gauge", "Average frequency while not halted (APERF/MPERF)");
+	for (const CpuSample& cpu : sample.cpus)
+	{
+		appendValue("ryzen_pstates_effective_frequency_mhz", labels[cpu.cpu], nullptr, cpu.frequencyMhz);
+	}
+
+	beginFamily("ryzen_pstates_core_power_watts", "gauge", "Core power from the RAPL core energy counter");
+	for (const CpuSample& cpu : sample.cpus)
+	{
+		appendValue("ryzen_pstates_core_power_watts", labels[cpu.cpu], nullptr, cpu.corePowerWatts);
+	}
+
+	beginFamily("ryzen_pstates_core_energy_joules_total", "counter", "Core energy since the exporter started");
+	for (const CpuSample& cpu : sample.cpus)
+	{
+		appendValue("ryzen_pstates_core_energy_joules_total", labels[cpu.cpu], nullptr, cpu.coreEnergyJoules);
+	}
+
+	beginFamily("ryzen_pstates_package_power_watts", "gauge", "Package power from the RAPL package energy counter");
+	appendValue("ryzen_pstates_package_power_watts", "", nullptr, sample.packagePowerWatts);
+
+	beginFamily("ryzen_pstates_package_energy_joules_total", "counter", "Package energy since the exporter started");
+	appendValue("ryzen_pstates_package_energy_joules_total", "", nullptr, sample.packageEnergyJoules);
+
+	beginFamily("ryzen_pstates_temperature_celsius", "gauge", "Control temperature (Tctl) of the package");
+	appendValue("ryzen_pstates_temperature_celsius", "", nullptr, sample.temperature);
+
+	beginFamily("ryzen_pstates_fabric_clock_mhz", "gauge", "Fabric, memory controller and memory clock, 0 if unknown");
+	appendValue("ryzen_pstates_fabric_clock_mhz", "clock=\"fclk\"", nullptr, fabricClocks.fclkMhz);
+	appendValue("ryzen_pstates_fabric_clock_mhz", "clock=\"uclk\"", nullptr, fabricClocks.uclkMhz);
+	appendValue("ryzen_pstates_fabric_clock_mhz", "clock=\"memclk\"", nullptr, fabricClocks.memclkMhz);
+
+	writeFile();
+}
+
+void PrometheusExporter::readDefinitions()
+{
+	// the budget command can give every core its own definitions, so every thread is read
+	for (int pstate = 0; pstate < NUM_PSTATES; pstate++)
+	{
+		for (int thread = 0; thread < numThreads; thread++)
+		{
+			definitions[(size_t)thread * NUM_PSTATES + pstate] = readMsr(PowerState::getRegister(pstate), (DWORD_PTR)1 << thread);
+		}
+	}
+}
+
+void PrometheusExporter::beginFamily(const char* name, const char* type, const char* help)
+{
+	buffer.append("# HELP ").append(name).append(" ").append(help).append("\n");
+	buffer.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+void PrometheusExporter::appendValue(const char* name, const std::string& labelSet, const char* extraLabel, double value)
+{
+	buffer.append(name);
+	if (!labelSet.empty() || extraLabel)
+	{
+		buffer.append("{").append(labelSet);
+		if (extraLabel)
+		{
+			buffer.append(labelSet.empty() ? "" : ",").append(extraLabel);
+		}
+		buffer.append("}");
+	}
+
+	// formatted on the stack, the buffer keeps its capacity between exports
+	char number[32];
+	int length = std::snprintf(number, sizeof(number), " %.10g\n", value);
+	buffer.append(number, length);
+}
+
+void PrometheusExporter::writeFile()
+{
+	HANDLE file = CreateFileA(temporaryPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		throw std::runtime_error("Failed to create '" + temporaryPath + "'");
+	}
+
+	DWORD written;
+	BOOL success = WriteFile(file, buffer.data(), (DWORD)buffer.size(), &written, nullptr) && written == buffer.size();
+	CloseHandle(file);
+
+	// the rename replaces the old file in one step
+	if (!success || !MoveFileExA(temporaryPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		throw std::runtime_error("Failed to write '" + path + "'");
+	}
+}
+
+void runPrometheusExport(const std::string& path, int numThreads, DWORD intervalMs)
+{
+	PciSmnAccess smn;
+	Sampler sampler(numThreads, smn);
+	PrometheusExporter exporter(path, numThreads, tryReadFabricClocks(smn));
+
+	installStopHandler();
+	std::cout << "Writing metrics of " << numThreads << " threads to '" << path
+		<< "' every " << intervalMs << " ms, press Ctrl+C to stop" << std::endl;
+
+	while (!isStopRequested())
+	{
+		Sleep(intervalMs);
+		exporter.write(sampler.sample());
+	}
+
+	removeStopHandler();
+	std::cout << "Stopped writing metrics" << std::endl;
+}
+
+static bool isEnabled(uint64_t definition)
+{
+	// PStateEn
+	return (definition >> 63 & 0x1) != 0;
+}
@@ -0,0 +1,38 @@
+﻿#pragma once
+#include <string>
+#include <vector>
+
+#include <Windows.h>
+
+#include "FabricClock.h"
+#include "Sampler.h"
+#include "Topology.h"
+
+// writes the metrics in the Prometheus text format for the textfile collector of node_exporter.
+// the file is written next to its final name and renamed over it, so the collector never sees a
+// partial file. labels and the text buffer are built once, an export only formats numbers
+class PrometheusExporter
+{
+public:
+	PrometheusExporter(const std::string& path, int numThreads, const FabricClocks& fabricClocks);
+
+	// reads the pstate definitions of every thread and writes them with the sample
+	void write(const SystemSample& sample);
+
+private:
+	std::string path;
+	std::string temporaryPath;
+	int numThreads;
+	FabricClocks fabricClocks;
+	std::vector<std::string> labels; // cpu, core and ccx label set of every thread
+	std::vector<uint64_t> definitions; // [thread * 8 + pstate]
+	std::string buffer;
+
+	void readDefinitions();
+	void beginFamily(const char* name, const char* type, const char* help);
+	void appendValue(const char* name, const std::string& labelSet, const char* extraLabel, double value);
+	void writeFile();
+};
+
+// samples every interval and rewrites the file until Ctrl+C
+void runPrometheusExport(const std::string& path, int numThreads, DWORD intervalMs);
@@ -0,0 +1,73 @@
+﻿#include "Sampler.h"
+
+#include "Trace.h"
+#include "Tsc.h"
+
+Sampler::Sampler(int numThreads, SmnAccess& smn)
+	:smn(smn), tscHz(calibrateTscFrequency()), energyUnit(readEnergyUnit()),
+	current(), previousClocks(numThreads), previousCoreEnergy(numThreads)
+{
+	current.cpus.resize(numThreads);
+	current.timestamp = readTsc();
+
+	for (int cpu = 0; cpu < numThreads; cpu++)
+	{
+		DWORD_PTR mask = (DWORD_PTR)1 << cpu;
+		current.cpus[cpu].cpu = cpu;
+		previousClocks[cpu] = readClockCounters(mask);
+		previousCoreEnergy[cpu] = readCoreEnergy(mask);
+	}
+
+	previousPackageEnergy = readPackageEnergy();
+}
+
+const SystemSample& Sampler::sample()
+{
+	TraceSpan span("sample");
+
+	uint64_t now = readTsc();
+	current.intervalSeconds = (now - current.timestamp) / tscHz;
+	current.timestamp = now;
+
+	for (CpuSample& cpuSample : current.cpus)
+	{
+		DWORD_PTR mask = (DWORD_PTR)1 << cpuSample.cpu;
+		ClockCounters clocks = readClockCounters(mask);
+		uint32_t coreEnergy = readCoreEnergy(mask);
+
+		cpuSample.pstate = readCurrentPstate(mask);
+		cpuSample.aperfDelta = clocks.aperf - previousClocks[cpuSample.cpu].aperf;
+		cpuSample.mperfDelta = clocks.mperf - previousClocks[cpuSample.cpu].mperf;
+		cpuSample.frequencyMhz = calculateEffectiveFrequency(previousClocks[cpuSample.cpu], clocks, tscHz);
+
+		// unsigned arithmetic takes care of a single wrap around of the 32 bit counter
+		cpuSample.coreEnergyDelta = coreEnergy - previousCoreEnergy[cpuSample.cpu];
+		cpuSample.coreEnergyJoules += cpuSample.coreEnergyDelta * energyUnit;
+		cpuSample.corePowerWatts = current.intervalSeconds > 0
+			? cpuSample.coreEnergyDelta * energyUnit / current.intervalSeconds : 0;
+
+		previousClocks[cpuSample.cpu] = clocks;
+		previousCoreEnergy[cpuSample.cpu] = coreEnergy;
+	}
+
+	uint32_t packageEnergy = readPackageEnergy();
+	current.packageEnergyDelta = packageEnergy - previousPackageEnergy;
+	current.packageEnergyJoules += current.packageEnergyDelta * energyUnit;
+	current.packagePowerWatts = current.intervalSeconds > 0
+		? current.packageEnergyDelta * energyUnit / current.intervalSeconds : 0;
+	previousPackageEnergy = packageEnergy;
+
+	current.temperature = readTemperature(smn);
+
+	return current;
+}
+
+double Sampler::getTscFrequency() const
+{
+	return tscHz;
+}
+
+double Sampler::getEnergyUnit() const
+{
+	return energyUnit;
+}
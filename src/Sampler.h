@@ -0,0 +1,53 @@
+﻿#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "CpuStatus.h"
+#include "Smn.h"
+
+struct CpuSample
+{
+	int cpu{ 0 };
+	int pstate{ 0 };
+	uint64_t aperfDelta{ 0 };
+	uint64_t mperfDelta{ 0 };
+	uint32_t coreEnergyDelta{ 0 }; // raw energy counts since the previous sample
+	double frequencyMhz{ 0 };
+	double corePowerWatts{ 0 };
+	double coreEnergyJoules{ 0 }; // accumulated since the sampler was created
+};
+
+struct SystemSample
+{
+	uint64_t timestamp{ 0 }; // TSC
+	double intervalSeconds{ 0 };
+	double temperature{ 0 };
+	double packagePowerWatts{ 0 };
+	uint32_t packageEnergyDelta{ 0 }; // raw energy counts since the previous sample
+	double packageEnergyJoules{ 0 }; // accumulated since the sampler was created
+	std::vector<CpuSample> cpus;
+};
+
+// samples APERF/MPERF, PStateStat and the energy counters of every hardware thread and the
+// package temperature. every sample contains the deltas to the previous one, all buffers are
+// allocated once, so sampling doesn't allocate
+class Sampler
+{
+public:
+	Sampler(int numThreads, SmnAccess& smn);
+
+	const SystemSample& sample();
+
+	double getTscFrequency() const;
+	double getEnergyUnit() const;
+
+private:
+	SmnAccess& smn;
+	double tscHz;
+	double energyUnit;
+
+	SystemSample current;
+	std::vector<ClockCounters> previousClocks;
+	std::vector<uint32_t> previousCoreEnergy;
+	uint32_t previousPackageEnergy;
+};
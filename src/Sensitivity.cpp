@@ -0,0 +1,215 @@
+﻿#include "Sensitivity.h"
+
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include "ChildProcess.h"
+#include "CpuStatus.h"
+#include "Msr.h"
+#include "Pmc.h"
+#include "PowerState.h"
+#include "Threads.h"
+#include "Trace.h"
+#include "Tsc.h"
+
+// constants
+// the package energy counter wraps after a few minutes under load, so it is read at least this often
+static constexpr DWORD ENERGY_POLL_INTERVAL_MS{ 1000 };
+
+std::vector<OperatingPoint> getEnabledOperatingPoints()
+{
+	std::vector<OperatingPoint> points;
+
+	for (int pstate = 0; pstate < 8; pstate++)
+	{
+		uint64_t value = readMsr(PowerState::getRegister(pstate), 0x1);
+
+		// PStateEn, the PowerState constructor refuses disabled pstates
+		if (!(value >> 63 & 0x1))
+		{
+			continue;
+		}
+
+		PowerState powerState(pstate, value);
+		points.push_back({ "P" + std::to_string(pstate), powerState.getFid(), powerState.getDid(), powerState.getVid() });
+	}
+
+	return points;
+}
+
+std::vector<OperatingPoint> parseOperatingPoints(const std::string& spec, unsigned int vid)
+{
+	if (vid < PowerState::VID_MIN || vid > PowerState::VID_MAX)
+	{
+		throw std::invalid_argument("VID of the operating points is out of the limits");
+	}
+
+	std::vector<OperatingPoint> points;
+	std::istringstream specStream(spec);
+	std::string entry;
+
+	while (std::getline(specStream, entry, ','))
+	{
+		std::istringstream entryStream(entry);
+		unsigned int fid;
+		unsigned int did;
+		char separator;
+
+		if (!(entryStream >> fid >> separator >> did) || separator != ':' || !entryStream.eof())
+		{
+			throw std::invalid_argument("Operating point '" + entry + "' must have the form fid:did");
+		}
+
+		if (fid < PowerState::FID_MIN || fid > PowerState::FID_MAX
+			|| did < PowerState::DID_MIN || did > PowerState::DID_MAX)
+		{
+			throw std::invalid_argument("Operating point '" + entry + "' is out of the FID or DID limits");
+		}
+
+		points.push_back({ entry, (uint8_t)fid, (uint8_t)did, (uint8_t)vid });
+	}
+
+	if (points.empty())
+	{
+		throw std::invalid_argument("No operating points given");
+	}
+
+	return points;
+}
+
+WorkloadResult runWorkload(const std::string& commandLine, int numThreads)
+{
+	TraceSpan span("runWorkload");
+
+	DWORD_PTR allThreadsMask = getAllThreadsMask(numThreads);
+	double tscHz = calibrateTscFrequency();
+	double energyUnit = readEnergyUnit();
+	PerformanceCounters counters(allThreadsMask);
+
+	std::vector<PerformanceCounters::Values> countersBefore(numThreads);
+	ClockCounters clocksBefore;
+	for (int thread = 0; thread < numThreads; thread++)
+	{
+		ClockCounters clocks = readClockCounters((DWORD_PTR)1 << thread);
+		clocksBefore.aperf += clocks.aperf;
+		clocksBefore.mperf += clocks.mperf;
+		countersBefore[thread] = counters.read(thread);
+	}
+
+	WorkloadResult result;
+	uint32_t previousEnergy = readPackageEnergy();
+	uint64_t start = readTsc();
+
+	{
+		ChildProcess process(commandLine);
+
+		bool exited;
+		do
+		{
+			exited = process.wait(ENERGY_POLL_INTERVAL_MS);
+
+			uint32_t energy = readPackageEnergy();
+			result.packageJoules += (uint32_t)(energy - previousEnergy) * energyUnit;
+			previousEnergy = energy;
+		} while (!exited);
+
+		result.exitCode = process.getExitCode();
+	}
+
+	result.wallSeconds = (readTsc() - start) / tscHz;
+
+	ClockCounters clocksAfter;
+	uint64_t instructions = 0;
+	uint64_t cycles = 0;
+	for (int thread = 0; thread < numThreads; thread++)
+	{
+		ClockCounters clocks = readClockCounters((DWORD_PTR)1 << thread);
+		clocksAfter.aperf += clocks.aperf;
+		clocksAfter.mperf += clocks.mperf;
+
+		PerformanceCounters::Values delta = PerformanceCounters::delta(countersBefore[thread], counters.read(thread));
+		instructions += delta[PerformanceCounters::INSTRUCTIONS];
+		cycles += delta[PerformanceCounters::CYCLES];
+	}
+
+	result.frequencyMhz = calculateEffectiveFrequency(clocksBefore, clocksAfter, tscHz);
+	result.ipc = cycles ? (double)instructions / cycles : 0;
+
+	return result;
+}
+
+void printSensitivityReport(const std::vector<WorkloadResult>& results)
+{
+	if (results.empty())
+	{
+		return;
+	}
+
+	// everything is relative to the point with the highest effective frequency
+	const WorkloadResult* fastest = &results[0];
+	const WorkloadResult* bestEdp = &results[0];
+	for (const WorkloadResult& result : results)
+	{
+		if (result.frequencyMhz > fastest->frequencyMhz)
+		{
+			fastest = &result;
+		}
+
+		if (result.packageJoules * result.wallSeconds < bestEdp->packageJoules * bestEdp->wallSeconds)
+		{
+			bestEdp = &result;
+		}
+	}
+
+	std::cout << std::left << std::setw(14) << "Point"
+		<< std::setw(10) << "MHz"
+		<< std::setw(10) << "Time s"
+		<< std::setw(10) << "Time %"
+		<< std::setw(12) << "Energy J"
+		<< std::setw(10) << "Energy %"
+		<< std::setw(10) << "Power W"
+		<< std::setw(8) << "IPC"
+		<< std::setw(14) << "EDP Js"
+		<< "Sensitivity" << std::endl;
+
+	for (const WorkloadResult& result : results)
+	{
+		double edp = result.packageJoules * result.wallSeconds;
+
+		std::cout << std::left << std::setw(14) << result.point.name << std::fixed
+			<< std::setprecision(0) << std::setw(10) << result.frequencyMhz
+			<< std::setprecision(3) << std::setw(10) << result.wallSeconds
+			<< std::setprecision(1) << std::setw(10) << result.wallSeconds * 100 / fastest->wallSeconds
+			<< std::setprecision(1) << std::setw(12) << result.packageJoules
+			<< std::setprecision(1) << std::setw(10) << result.packageJoules * 100 / fastest->packageJoules
+			<< std::setprecision(1) << std::setw(10) << result.packageJoules / result.wallSeconds
+			<< std::setprecision(2) << std::setw(8) << result.ipc
+			<< std::setprecision(1) << std::setw(14) << edp;
+
+		// 1.0 means the runtime scales inversely with frequency (compute bound), 0.0 means it
+		// doesn't depend on the core clock at all (memory or I/O bound)
+		if (&result != fastest && result.frequencyMhz > 0 && result.frequencyMhz != fastest->frequencyMhz)
+		{
+			std::cout << std::setprecision(2)
+				<< std::log(result.wallSeconds / fastest->wallSeconds) / std::log(fastest->frequencyMhz / result.frequencyMhz);
+		}
+		else
+		{
+			std::cout << "-";
+		}
+
+		if (result.exitCode)
+		{
+			std::cout << "  (exit code " << result.exitCode << ")";
+		}
+
+		std::cout << std::endl;
+	}
+
+	std::cout << std::defaultfloat << std::right
+		<< "Lowest energy-delay product: " << bestEdp->point.name
+		<< " at " << std::fixed << std::setprecision(0) << bestEdp->frequencyMhz << " MHz" << std::defaultfloat << std::endl;
+}
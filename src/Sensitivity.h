@@ -0,0 +1,38 @@
+﻿#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <Windows.h>
+
+// a frequency and voltage the workload is run at, applied as pstate 0
+struct OperatingPoint
+{
+	std::string name;
+	uint8_t fid{ 0 };
+	uint8_t did{ 0 };
+	uint8_t vid{ 0 };
+};
+
+struct WorkloadResult
+{
+	OperatingPoint point;
+	DWORD exitCode{ 0 };
+	double wallSeconds{ 0 };
+	double frequencyMhz{ 0 }; // effective frequency of all threads while not halted
+	double ipc{ 0 };
+	double packageJoules{ 0 };
+};
+
+// the definitions of all enabled pstates
+std::vector<OperatingPoint> getEnabledOperatingPoints();
+
+// parses a list of the form "fid:did[,fid:did...]", all points use the given vid
+std::vector<OperatingPoint> parseOperatingPoints(const std::string& spec, unsigned int vid);
+
+// runs the command line to completion and measures it on all threads
+WorkloadResult runWorkload(const std::string& commandLine, int numThreads);
+
+// prints runtime and energy against frequency, relative to the fastest point,
+// and the point with the lowest energy-delay product
+void printSensitivityReport(const std::vector<WorkloadResult>& results);
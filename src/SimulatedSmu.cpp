@@ -0,0 +1,106 @@
+﻿#include "SimulatedSmu.h"
+
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+// constants
+static constexpr uint32_t RESPONSE_OK{ 0x01 };
+static constexpr uint32_t RESPONSE_UNKNOWN_COMMAND{ 0xFE };
+static constexpr double SIMULATED_MEMCLK_MHZ{ 1800 };
+
+SimulatedSmu::SimulatedSmu(const SmuMessageTable& table, bool unresponsive)
+	:table(table), unresponsive(unresponsive), dram(TABLE_SIZE, 0)
+{
+	// stock limits of a 65W desktop part
+	limits.pptWatts = 88;
+	limits.tdcAmps = 60;
+	limits.edcAmps = 90;
+
+	// the SMU is idle and ready for a message
+	registers[table.responseAddress] = RESPONSE_OK;
+}
+
+uint32_t SimulatedSmu::read(uint32_t address)
+{
+	return registers[address];
+}
+
+void SimulatedSmu::write(uint32_t address, uint32_t value)
+{
+	registers[address] = value;
+
+	if (address == table.commandAddress && !unresponsive)
+	{
+		registers[table.responseAddress] = handleMessage(value);
+	}
+}
+
+void SimulatedSmu::readPhysicalMemory(uint64_t address, void* buffer, size_t size)
+{
+	if (address < DRAM_BASE_ADDRESS || address + size > DRAM_BASE_ADDRESS + dram.size())
+	{
+		throw std::runtime_error("Simulated SMU: physical memory read outside of the table");
+	}
+
+	std::memcpy(buffer, &dram[address - DRAM_BASE_ADDRESS], size);
+}
+
+uint32_t SimulatedSmu::handleMessage(uint32_t message)
+{
+	uint32_t argument = registers[table.argumentAddress];
+	std::cout << "Simulated SMU: message 0x" << std::hex << std::uppercase << message
+		<< ", argument 0x" << argument << std::dec << std::endl;
+
+	if (message == 0)
+	{
+		return RESPONSE_UNKNOWN_COMMAND;
+	}
+	else if (message == table.setPptLimit)
+	{
+		limits.pptWatts = argument / 1000.0;
+	}
+	else if (message == table.setTdcLimit)
+	{
+		limits.tdcAmps = argument / 1000.0;
+	}
+	else if (message == table.setEdcLimit)
+	{
+		limits.edcAmps = argument / 1000.0;
+	}
+	else if (message == table.getDramBaseAddress)
+	{
+		registers[table.argumentAddress] = (uint32_t)DRAM_BASE_ADDRESS;
+		registers[table.argumentAddress + 4] = (uint32_t)(DRAM_BASE_ADDRESS >> 32);
+	}
+	else if (message == table.getTableVersion)
+	{
+		registers[table.argumentAddress] = table.clockTableVersion;
+	}
+	else if (message == table.transferTableToDram)
+	{
+		writeTableValue(table.pptLimitOffset, limits.pptWatts);
+		writeTableValue(table.tdcLimitOffset, limits.tdcAmps);
+		writeTableValue(table.edcLimitOffset, limits.edcAmps);
+
+		if (table.fclkOffset && table.uclkOffset && table.memclkOffset)
+		{
+			// DDR4-3600 with the fabric coupled 1:1
+			writeTableValue(table.fclkOffset, SIMULATED_MEMCLK_MHZ);
+			writeTableValue(table.uclkOffset, SIMULATED_MEMCLK_MHZ);
+			writeTableValue(table.memclkOffset, SIMULATED_MEMCLK_MHZ);
+		}
+	}
+	else
+	{
+		return RESPONSE_UNKNOWN_COMMAND;
+	}
+
+	return RESPONSE_OK;
+}
+
+void SimulatedSmu::writeTableValue(uint32_t offset, double value)
+{
+	float tableValue = (float)value;
+	std::memcpy(&dram[offset], &tableValue, sizeof(float));
+}
@@ -0,0 +1,32 @@
+﻿#pragma once
+#include <map>
+#include <vector>
+
+#include "Smn.h"
+#include "Smu.h"
+
+// answers mailbox messages of a message table like the SMU firmware would, so the SMU code
+// can be developed and checked without touching real hardware
+class SimulatedSmu : public SmnAccess
+{
+public:
+	// an unresponsive SMU never answers a message, to exercise the timeout handling
+	SimulatedSmu(const SmuMessageTable& table, bool unresponsive);
+
+	uint32_t read(uint32_t address) override;
+	void write(uint32_t address, uint32_t value) override;
+	void readPhysicalMemory(uint64_t address, void* buffer, size_t size) override;
+
+private:
+	const SmuMessageTable& table;
+	bool unresponsive;
+	std::map<uint32_t, uint32_t> registers;
+	PowerLimits limits;
+	std::vector<unsigned char> dram; // the power metrics table after the last transfer
+
+	static constexpr uint64_t DRAM_BASE_ADDRESS{ 0xDEAD0000 };
+	static constexpr size_t TABLE_SIZE{ 0x100 };
+
+	uint32_t handleMessage(uint32_t message);
+	void writeTableValue(uint32_t offset, double value);
+};
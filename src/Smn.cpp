@@ -0,0 +1,66 @@
+﻿#include "Smn.h"
+
+#include <sstream>
+#include <stdexcept>
+
+#include <Windows.h>
+#include "lib/OlsApi.h"
+#include "lib/OlsDef.h"
+
+// constants
+// the root complex is always bus 0, device 0, function 0
+static constexpr DWORD ROOT_COMPLEX{ PciBusDevFunc(0, 0, 0) };
+
+uint32_t PciSmnAccess::read(uint32_t address)
+{
+	selectAddress(address);
+
+	DWORD value;
+	if (!ReadPciConfigDwordEx(ROOT_COMPLEX, SMN_DATA_REGISTER, &value))
+	{
+		std::ostringstream errorMessage;
+		errorMessage << "Failed to read SMN address 0x" << std::hex << std::uppercase << address;
+		throw std::runtime_error(errorMessage.str());
+	}
+
+	return value;
+}
+
+void PciSmnAccess::write(uint32_t address, uint32_t value)
+{
+	selectAddress(address);
+
+	if (!WritePciConfigDwordEx(ROOT_COMPLEX, SMN_DATA_REGISTER, value))
+	{
+		std::ostringstream errorMessage;
+		errorMessage << "Failed to write SMN address 0x" << std::hex << std::uppercase << address;
+		throw std::runtime_error(errorMessage.str());
+	}
+}
+
+void PciSmnAccess::readPhysicalMemory(uint64_t address, void* buffer, size_t size)
+{
+#ifdef _PHYSICAL_MEMORY_SUPPORT
+	// WinRing0 reads physical memory in units of a byte
+	if (!ReadPhysicalMemory((DWORD_PTR)address, (PBYTE)buffer, (DWORD)size, 1))
+	{
+		std::ostringstream errorMessage;
+		errorMessage << "Failed to read physical memory at 0x" << std::hex << std::uppercase << address
+			<< " (the WinRing0 driver might have physical memory access disabled)";
+		throw std::runtime_error(errorMessage.str());
+	}
+#else
+	// WinRing0 only exports the physical memory functions when built with this define
+	throw std::runtime_error("Reading physical memory requires a build with _PHYSICAL_MEMORY_SUPPORT");
+#endif
+}
+
+void PciSmnAccess::selectAddress(uint32_t address)
+{
+	if (!WritePciConfigDwordEx(ROOT_COMPLEX, SMN_INDEX_REGISTER, address))
+	{
+		std::ostringstream errorMessage;
+		errorMessage << "Failed to select SMN address 0x" << std::hex << std::uppercase << address;
+		throw std::runtime_error(errorMessage.str());
+	}
+}
@@ -0,0 +1,32 @@
+﻿#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// access to the system management network (SMN) of the SoC and to physical memory,
+// abstracted so the SMU code can run against real hardware or a simulation
+class SmnAccess
+{
+public:
+	virtual ~SmnAccess() = default;
+
+	virtual uint32_t read(uint32_t address) = 0;
+	virtual void write(uint32_t address, uint32_t value) = 0;
+
+	// copies memory the SMU transferred a table to
+	virtual void readPhysicalMemory(uint64_t address, void* buffer, size_t size) = 0;
+};
+
+// SMN access through the index/data registers in the PCI config space of the root complex
+class PciSmnAccess : public SmnAccess
+{
+public:
+	uint32_t read(uint32_t address) override;
+	void write(uint32_t address, uint32_t value) override;
+	void readPhysicalMemory(uint64_t address, void* buffer, size_t size) override;
+
+private:
+	static constexpr uint32_t SMN_INDEX_REGISTER{ 0x60 };
+	static constexpr uint32_t SMN_DATA_REGISTER{ 0x64 };
+
+	void selectAddress(uint32_t address);
+};
@@ -0,0 +1,258 @@
+﻿#include "Smu.h"
+
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "Trace.h"
+
+// constants
+// addresses and message ids as used by ZenStates and RyzenAdj, the desktop parts are reached
+// through the RSMU mailbox, the APUs through the MP1 mailbox
+static constexpr SmuMessageTable SMU_MESSAGE_TABLES[]
+{
+	{
+		"Summit Ridge / Pinnacle Ridge", { 0x01, 0x08, 0 },
+		0x03B1051C, 0x03B10568, 0x03B10590,
+		0x64, 0x65, 0x66,
+		0, 0, 0, 0, 0,
+		0, 0, 0,
+		0, 0
+	},
+	{
+		"Raven Ridge / Picasso", { 0x11, 0x18, 0 },
+		0x03B10528, 0x03B10564, 0x03B10998,
+		0x1B, 0x20, 0x22, // fast PPT limit, VDD current limit, VDD peak current limit
+		0, 0, 0, 0, 0,
+		0, 0, 0,
+		0, 0
+	},
+	{
+		"Matisse", { 0x71, 0 },
+		0x03B10524, 0x03B10570, 0x03B10A40,
+		0x53, 0x54, 0x55,
+		0x05, 0x06, 0x000, 0x008, 0x020,
+		0x0C0, 0x0C8, 0x0CC,
+		0x08, 0x240903
+	},
+};
+
+const SmuMessageTable* findSmuMessageTable(unsigned int model)
+{
+	for (const SmuMessageTable& table : SMU_MESSAGE_TABLES)
+	{
+		for (int i = 0; table.models[i]; i++)
+		{
+			if (table.models[i] == model)
+			{
+				return &table;
+			}
+		}
+	}
+
+	return nullptr;
+}
+
+const SmuMessageTable* findSmuMessageTable(const char* name)
+{
+	for (const SmuMessageTable& table : SMU_MESSAGE_TABLES)
+	{
+		if (std::strstr(table.name, name))
+		{
+			return &table;
+		}
+	}
+
+	return nullptr;
+}
+
+Smu::Smu(SmnAccess& smn, const SmuMessageTable& table, DWORD timeoutMs)
+	:smn(smn), table(table), timeoutMs(timeoutMs)
+{
+}
+
+void Smu::sendMessage(uint32_t message, Args& args)
+{
+	TraceSpan span("smuMessage", "message", message);
+
+	// a response of 0 means the SMU is still busy with the previous message
+	waitForResponse(0);
+
+	smn.write(table.responseAddress, 0);
+	for (int i = 0; i < NUM_ARGS; i++)
+	{
+		smn.write(table.argumentAddress + 4 * i, args[i]);
+	}
+	smn.write(table.commandAddress, message);
+
+	uint32_t response = waitForResponse(message);
+	if (response != RESPONSE_OK)
+	{
+		std::ostringstream errorMessage;
+		errorMessage << "SMU rejected message 0x" << std::hex << std::uppercase << message << ": ";
+		switch (response)
+		{
+		case RESPONSE_FAILED:
+			errorMessage << "failed";
+			break;
+		case RESPONSE_UNKNOWN_COMMAND:
+			errorMessage << "unknown command";
+			break;
+		case RESPONSE_REJECTED_PREREQUISITE:
+			errorMessage << "prerequisite not met";
+			break;
+		case RESPONSE_REJECTED_BUSY:
+			errorMessage << "busy";
+			break;
+		default:
+			errorMessage << "response 0x" << response;
+			break;
+		}
+		throw std::runtime_error(errorMessage.str());
+	}
+
+	for (int i = 0; i < NUM_ARGS; i++)
+	{
+		args[i] = smn.read(table.argumentAddress + 4 * i);
+	}
+}
+
+void Smu::setPptLimit(double watts)
+{
+	sendLimit(table.setPptLimit, "PPT", watts);
+}
+
+void Smu::setTdcLimit(double amps)
+{
+	sendLimit(table.setTdcLimit, "TDC", amps);
+}
+
+void Smu::setEdcLimit(double amps)
+{
+	sendLimit(table.setEdcLimit, "EDC", amps);
+}
+
+bool Smu::canReadLimits() const
+{
+	return table.transferTableToDram && table.getDramBaseAddress;
+}
+
+PowerLimits Smu::readLimits()
+{
+	if (!canReadLimits())
+	{
+		throw std::runtime_error(std::string("Reading power limits is not supported on ") + table.name);
+	}
+
+	float values[3];
+	uint32_t offsets[3]{ table.pptLimitOffset, table.tdcLimitOffset, table.edcLimitOffset };
+	readTable(offsets, values, 3);
+
+	PowerLimits limits;
+	limits.pptWatts = values[0];
+	limits.tdcAmps = values[1];
+	limits.edcAmps = values[2];
+	return limits;
+}
+
+bool Smu::canReadClocks() const
+{
+	return canReadLimits() && table.fclkOffset && table.uclkOffset && table.memclkOffset
+		&& table.getTableVersion && table.clockTableVersion;
+}
+
+SmuClocks Smu::readClocks()
+{
+	if (!canReadClocks())
+	{
+		throw std::runtime_error(std::string("Reading the fabric clocks is not supported on ") + table.name);
+	}
+
+	// another firmware may have moved the clocks, reading them anyway would return unrelated values
+	if (readTableVersion() != table.clockTableVersion)
+	{
+		return SmuClocks();
+	}
+
+	float values[3];
+	uint32_t offsets[3]{ table.fclkOffset, table.uclkOffset, table.memclkOffset };
+	readTable(offsets, values, 3);
+
+	SmuClocks clocks;
+	clocks.fclkMhz = values[0];
+	clocks.uclkMhz = values[1];
+	clocks.memclkMhz = values[2];
+	return clocks;
+}
+
+const SmuMessageTable& Smu::getTable() const
+{
+	return table;
+}
+
+uint32_t Smu::waitForResponse(uint32_t message)
+{
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+
+	uint32_t response;
+	while ((response = smn.read(table.responseAddress)) == 0)
+	{
+		if (std::chrono::steady_clock::now() > deadline)
+		{
+			std::ostringstream errorMessage;
+			errorMessage << "SMU timed out after " << timeoutMs << " ms";
+			if (message)
+			{
+				errorMessage << " waiting for message 0x" << std::hex << std::uppercase << message;
+			}
+			throw std::runtime_error(errorMessage.str());
+		}
+		std::this_thread::yield();
+	}
+
+	return response;
+}
+
+uint32_t Smu::readTableVersion()
+{
+	Args args{};
+	sendMessage(table.getTableVersion, args);
+	return args[0];
+}
+
+void Smu::sendLimit(uint32_t message, const char* name, double value)
+{
+	if (!message)
+	{
+		throw std::runtime_error(std::string("Setting the ") + name + " limit is not supported on " + table.name);
+	}
+
+	if (value <= 0)
+	{
+		throw std::invalid_argument(std::string(name) + " limit must be positive");
+	}
+
+	// the SMU expects milliwatts and milliamps
+	Args args{};
+	args[0] = (uint32_t)(value * 1000);
+	sendMessage(message, args);
+}
+
+void Smu::readTable(const uint32_t* offsets, float* values, int count)
+{
+	// the SMU copies a fresh snapshot of the table on every transfer
+	Args args{};
+	sendMessage(table.getDramBaseAddress, args);
+	uint64_t tableAddress = args[0] | ((uint64_t)args[1] << 32);
+
+	args = Args{};
+	sendMessage(table.transferTableToDram, args);
+
+	for (int i = 0; i < count; i++)
+	{
+		smn.readPhysicalMemory(tableAddress + offsets[i], &values[i], sizeof(float));
+	}
+}
@@ -0,0 +1,100 @@
+﻿#pragma once
+#include <array>
+#include <cstdint>
+
+#include <Windows.h>
+
+#include "Smn.h"
+
+// mailbox addresses and message ids of the SMU firmware of one processor family
+// a message id of 0 means the message isn't known for this family
+struct SmuMessageTable
+{
+	const char* name;
+	unsigned int models[4]; // CPUID models of family 17h using this table, 0 terminated
+
+	uint32_t commandAddress;
+	uint32_t responseAddress;
+	uint32_t argumentAddress;
+
+	uint32_t setPptLimit; // argument in mW
+	uint32_t setTdcLimit; // argument in mA
+	uint32_t setEdcLimit; // argument in mA
+
+	// the current limits are only available from the power metrics table the SMU copies to DRAM
+	uint32_t transferTableToDram;
+	uint32_t getDramBaseAddress;
+	uint32_t pptLimitOffset; // byte offsets of the limits (float) in the table
+	uint32_t tdcLimitOffset;
+	uint32_t edcLimitOffset;
+
+	// byte offsets of the fabric, memory controller and memory clock (float, MHz) in the same table
+	uint32_t fclkOffset;
+	uint32_t uclkOffset;
+	uint32_t memclkOffset;
+
+	// the clock offsets differ between firmware versions, they are only used if the SMU reports
+	// this version of the table
+	uint32_t getTableVersion;
+	uint32_t clockTableVersion;
+};
+
+struct PowerLimits
+{
+	double pptWatts{ 0 };
+	double tdcAmps{ 0 };
+	double edcAmps{ 0 };
+};
+
+struct SmuClocks
+{
+	double fclkMhz{ 0 };
+	double uclkMhz{ 0 };
+	double memclkMhz{ 0 };
+};
+
+// returns the message table for a CPU model of family 17h, nullptr if the model isn't supported
+const SmuMessageTable* findSmuMessageTable(unsigned int model);
+
+// returns a message table by name (e.g. for the simulation), nullptr if there is none
+const SmuMessageTable* findSmuMessageTable(const char* name);
+
+class Smu
+{
+public:
+	static constexpr int NUM_ARGS{ 6 };
+	using Args = std::array<uint32_t, NUM_ARGS>;
+
+	Smu(SmnAccess& smn, const SmuMessageTable& table, DWORD timeoutMs);
+
+	// sends a message through the mailbox and waits for the response, the arguments are
+	// replaced by the values the SMU returns. throws on timeout or if the SMU rejects the message
+	void sendMessage(uint32_t message, Args& args);
+
+	void setPptLimit(double watts);
+	void setTdcLimit(double amps);
+	void setEdcLimit(double amps);
+	bool canReadLimits() const;
+	PowerLimits readLimits();
+	bool canReadClocks() const;
+	// all clocks are 0 (unknown) if the table version doesn't match the known offsets
+	SmuClocks readClocks();
+
+	const SmuMessageTable& getTable() const;
+
+private:
+	SmnAccess& smn;
+	const SmuMessageTable& table;
+	DWORD timeoutMs;
+
+	static constexpr uint32_t RESPONSE_OK{ 0x01 };
+	static constexpr uint32_t RESPONSE_FAILED{ 0xFF };
+	static constexpr uint32_t RESPONSE_UNKNOWN_COMMAND{ 0xFE };
+	static constexpr uint32_t RESPONSE_REJECTED_PREREQUISITE{ 0xFD };
+	static constexpr uint32_t RESPONSE_REJECTED_BUSY{ 0xFC };
+
+	uint32_t waitForResponse(uint32_t message);
+	uint32_t readTableVersion();
+	void readTable(const uint32_t* offsets, float* values, int count);
+	void sendLimit(uint32_t message, const char* name, double value);
+};
@@ -0,0 +1,49 @@
+﻿#include "Statistics.h"
+
+#include <algorithm>
+#include <iostream>
+#include <numeric>
+
+// prototypes
+static double percentile(const std::vector<uint64_t>& sortedSamples, double fraction);
+
+Distribution summarize(std::vector<uint64_t> samples, double scale)
+{
+	Distribution distribution;
+
+	if (samples.empty())
+	{
+		return distribution;
+	}
+
+	std::sort(samples.begin(), samples.end());
+
+	distribution.count = samples.size();
+	distribution.min = samples.front() * scale;
+	distribution.max = samples.back() * scale;
+	distribution.mean = std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size() * scale;
+	distribution.median = percentile(samples, 0.5) * scale;
+	distribution.p90 = percentile(samples, 0.9) * scale;
+	distribution.p99 = percentile(samples, 0.99) * scale;
+	distribution.p999 = percentile(samples, 0.999) * scale;
+
+	return distribution;
+}
+
+void printDistribution(const Distribution& distribution, const std::string& unit)
+{
+	std::cout << "Samples: " << distribution.count
+		<< "\nMin (" << unit << "): " << distribution.min
+		<< "\nMean (" << unit << "): " << distribution.mean
+		<< "\nMedian (" << unit << "): " << distribution.median
+		<< "\np90 (" << unit << "): " << distribution.p90
+		<< "\np99 (" << unit << "): " << distribution.p99
+		<< "\np99.9 (" << unit << "): " << distribution.p999
+		<< "\nMax (" << unit << "): " << distribution.max << std::endl;
+}
+
+static double percentile(const std::vector<uint64_t>& sortedSamples, double fraction)
+{
+	size_t index = (size_t)(fraction * (sortedSamples.size() - 1) + 0.5);
+	return (double)sortedSamples[index];
+}
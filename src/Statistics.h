@@ -0,0 +1,21 @@
+﻿#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct Distribution
+{
+	size_t count{ 0 };
+	double min{ 0 };
+	double mean{ 0 };
+	double median{ 0 };
+	double p90{ 0 };
+	double p99{ 0 };
+	double p999{ 0 };
+	double max{ 0 };
+};
+
+// summarizes raw samples, each sample is multiplied by scale (e.g. to convert TSC ticks to us)
+Distribution summarize(std::vector<uint64_t> samples, double scale = 1.0);
+
+void printDistribution(const Distribution& distribution, const std::string& unit);
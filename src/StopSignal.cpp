@@ -0,0 +1,32 @@
+﻿#include "StopSignal.h"
+
+#include <atomic>
+
+#include <Windows.h>
+
+static std::atomic<bool> stopRequested{ false };
+
+// prototypes
+static BOOL WINAPI onConsoleCtrl(DWORD ctrlType);
+
+void installStopHandler()
+{
+	stopRequested = false;
+	SetConsoleCtrlHandler(onConsoleCtrl, TRUE);
+}
+
+void removeStopHandler()
+{
+	SetConsoleCtrlHandler(onConsoleCtrl, FALSE);
+}
+
+bool isStopRequested()
+{
+	return stopRequested;
+}
+
+static BOOL WINAPI onConsoleCtrl(DWORD ctrlType)
+{
+	stopRequested = true;
+	return TRUE;
+}
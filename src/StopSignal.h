@@ -0,0 +1,7 @@
+﻿#pragma once
+
+// long running commands run until Ctrl+C (or the console is closed) and then clean up
+// installs the console handler and clears a previous stop request
+void installStopHandler();
+void removeStopHandler();
+bool isStopRequested();
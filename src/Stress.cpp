@@ -0,0 +1,106 @@
+﻿#include "Stress.h"
+
+#include <chrono>
+
+#include "Threads.h"
+#include "Trace.h"
+
+// constants
+static constexpr int STRESS_NUM_SEEDS{ 4 };
+
+uint64_t stressKernel(uint64_t seed, uint64_t iterations)
+{
+	uint64_t state = seed * 0x9E3779B97F4A7C15ull;
+	uint64_t sum = 0;
+
+	for (uint64_t i = 0; i < iterations; i++)
+	{
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		sum += state * (i | 1);
+	}
+
+	return sum;
+}
+
+bool runStressKernel(uint64_t seedBase, DWORD durationMs)
+{
+	volatile uint64_t seeds[STRESS_NUM_SEEDS];
+	uint64_t expected[STRESS_NUM_SEEDS];
+	for (int i = 0; i < STRESS_NUM_SEEDS; i++)
+	{
+		seeds[i] = seedBase * STRESS_NUM_SEEDS + i + 1;
+		expected[i] = stressKernel(seeds[i], STRESS_CHUNK_ITERATIONS);
+	}
+
+	volatile uint64_t sink = 0;
+	bool stable = true;
+
+	auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(durationMs);
+	for (int pass = 0; std::chrono::steady_clock::now() < end; pass = (pass + 1) % STRESS_NUM_SEEDS)
+	{
+		uint64_t result = stressKernel(seeds[pass], STRESS_CHUNK_ITERATIONS);
+		sink = result;
+		if (result != expected[pass])
+		{
+			stable = false;
+		}
+	}
+
+	return stable;
+}
+
+Stress::Stress(DWORD_PTR mask, DWORD durationMs)
+	:running(0), stable(true)
+{
+	std::vector<int> threads = getThreadsInMask(mask);
+	running = (int)threads.size();
+
+	for (int thread : threads)
+	{
+		workers.emplace_back([this, thread, durationMs]() {
+			TraceSpan span("stress", "thread", thread);
+
+			try
+			{
+				pinCurrentThread(thread);
+				if (!runStressKernel(thread, durationMs))
+				{
+					stable = false;
+				}
+			}
+			catch (...)
+			{
+				// a worker that can't be pinned didn't stress its thread, so nothing is certified
+				stable = false;
+			}
+
+			running--;
+		});
+	}
+}
+
+Stress::~Stress()
+{
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+bool Stress::wait(DWORD timeoutMs)
+{
+	auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+	while (running && std::chrono::steady_clock::now() < end)
+	{
+		Sleep(10);
+	}
+
+	return !running;
+}
+
+bool Stress::isStable() const
+{
+	return stable;
+}
@@ -0,0 +1,43 @@
+﻿#pragma once
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include <Windows.h>
+
+// iterations of one kernel call, roughly 10 ms
+static constexpr uint64_t STRESS_CHUNK_ITERATIONS{ 1 << 22 };
+
+// integer multiply and shift chain with a deterministic result, a mismatch means the core
+// computed something wrong at the frequency/voltage it is running at
+uint64_t stressKernel(uint64_t seed, uint64_t iterations);
+
+// runs the kernel on the calling thread until the duration is over and checks every result.
+// the seeds are read through a volatile on every pass and the results go to a volatile sink, so
+// the optimizer can neither compute the kernel once nor fold the check away. false on a mismatch
+bool runStressKernel(uint64_t seedBase, DWORD durationMs);
+
+// runs the stress kernel on every thread in the mask in parallel, each worker pinned to its thread
+class Stress
+{
+public:
+	Stress(DWORD_PTR mask, DWORD durationMs);
+
+	// waits for the workers, the destructor must not leave them running
+	virtual ~Stress();
+
+	Stress(const Stress&) = delete;
+	Stress& operator=(const Stress&) = delete;
+
+	// returns true once all workers are done, false if the timeout elapsed
+	bool wait(DWORD timeoutMs);
+
+	// false if any worker computed a wrong result, valid after wait returned true
+	bool isStable() const;
+
+private:
+	std::vector<std::thread> workers;
+	std::atomic<int> running;
+	std::atomic<bool> stable;
+};
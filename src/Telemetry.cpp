@@ -0,0 +1,93 @@
+﻿#include "Telemetry.h"
+
+#include <iostream>
+#include <new>
+#include <stdexcept>
+
+#include "StopSignal.h"
+
+TelemetryPublisher::TelemetryPublisher(const std::string& name, int numCpus, double tscHz, const FabricClocks& fabricClocks)
+{
+	DWORD size = (DWORD)(sizeof(TelemetryHeader) + numCpus * sizeof(TelemetryRecord));
+
+	mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, size, name.c_str());
+	if (!mapping)
+	{
+		throw std::runtime_error("Failed to create shared memory segment '" + name + "'");
+	}
+
+	void* view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (!view)
+	{
+		CloseHandle(mapping);
+		throw std::runtime_error("Failed to map shared memory segment '" + name + "'");
+	}
+
+	// the mapping is page aligned, so the records are cache line aligned as well
+	header = new (view) TelemetryHeader{};
+	records = reinterpret_cast<TelemetryRecord*>(header + 1);
+	for (int cpu = 0; cpu < numCpus; cpu++)
+	{
+		new (&records[cpu]) TelemetryRecord{};
+	}
+
+	header->version = TELEMETRY_VERSION;
+	header->numCpus = numCpus;
+	header->recordSize = sizeof(TelemetryRecord);
+	header->tscHz = tscHz;
+	header->fclkMhz = fabricClocks.fclkMhz;
+	header->uclkMhz = fabricClocks.uclkMhz;
+	header->memclkMhz = fabricClocks.memclkMhz;
+
+	// the magic goes last, readers can use it to see that the segment is initialized
+	std::atomic_thread_fence(std::memory_order_release);
+	header->magic = TELEMETRY_MAGIC;
+}
+
+TelemetryPublisher::~TelemetryPublisher()
+{
+	UnmapViewOfFile(header);
+	CloseHandle(mapping);
+}
+
+void TelemetryPublisher::publish(const SystemSample& sample)
+{
+	for (const CpuSample& cpuSample : sample.cpus)
+	{
+		TelemetryRecord& record = records[cpuSample.cpu];
+		uint32_t sequence = record.sequence.load(std::memory_order_relaxed);
+
+		record.sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		record.pstate = cpuSample.pstate;
+		record.timestamp = sample.timestamp;
+		record.frequencyMhz = cpuSample.frequencyMhz;
+		record.temperature = sample.temperature;
+		record.corePowerWatts = cpuSample.corePowerWatts;
+		record.packagePowerWatts = sample.packagePowerWatts;
+		record.coreEnergyJoules = cpuSample.coreEnergyJoules;
+
+		record.sequence.store(sequence + 2, std::memory_order_release);
+	}
+}
+
+void runTelemetryExport(const std::string& name, int numThreads, DWORD intervalMs)
+{
+	PciSmnAccess smn;
+	Sampler sampler(numThreads, smn);
+	TelemetryPublisher publisher(name, numThreads, sampler.getTscFrequency(), tryReadFabricClocks(smn));
+
+	installStopHandler();
+	std::cout << "Publishing telemetry of " << numThreads << " threads to '" << name
+		<< "' every " << intervalMs << " ms, press Ctrl+C to stop" << std::endl;
+
+	while (!isStopRequested())
+	{
+		Sleep(intervalMs);
+		publisher.publish(sampler.sample());
+	}
+
+	removeStopHandler();
+	std::cout << "Stopped publishing telemetry" << std::endl;
+}
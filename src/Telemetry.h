@@ -0,0 +1,103 @@
+﻿#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include <Windows.h>
+
+#include "FabricClock.h"
+#include "Sampler.h"
+
+// layout of the shared memory segment
+// [TelemetryHeader][TelemetryRecord cpu 0][TelemetryRecord cpu 1]...
+
+static constexpr uint32_t TELEMETRY_MAGIC{ 0x52505354 }; // "RPST"
+static constexpr uint32_t TELEMETRY_VERSION{ 2 };
+static constexpr char TELEMETRY_DEFAULT_NAME[]{ "Local\\RyzenPstatesTelemetry" };
+
+struct alignas(64) TelemetryHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t numCpus;
+	uint32_t recordSize;
+	double tscHz;
+	// read once when publishing starts, 0 if unknown
+	double fclkMhz;
+	double uclkMhz;
+	double memclkMhz;
+};
+
+// one record per cpu, each in its own cache line so writers of different records and
+// readers don't share lines. protected by a sequence lock: the sequence is odd while the
+// writer updates the record, readers retry until they see the same even sequence twice
+struct alignas(64) TelemetryRecord
+{
+	std::atomic<uint32_t> sequence;
+	uint32_t pstate;
+	uint64_t timestamp; // TSC
+	double frequencyMhz;
+	double temperature; // package Tctl
+	double corePowerWatts;
+	double packagePowerWatts;
+	double coreEnergyJoules;
+};
+
+static_assert(sizeof(TelemetryRecord) == 64, "A telemetry record must fit into one cache line");
+
+struct TelemetryValues
+{
+	uint32_t pstate;
+	uint64_t timestamp;
+	double frequencyMhz;
+	double temperature;
+	double corePowerWatts;
+	double packagePowerWatts;
+	double coreEnergyJoules;
+};
+
+// wait free for the writer, a reader only spins while a write is in progress
+inline TelemetryValues readTelemetryRecord(const TelemetryRecord& record)
+{
+	TelemetryValues values;
+	uint32_t before;
+	uint32_t after;
+
+	do
+	{
+		before = record.sequence.load(std::memory_order_acquire);
+		values.pstate = record.pstate;
+		values.timestamp = record.timestamp;
+		values.frequencyMhz = record.frequencyMhz;
+		values.temperature = record.temperature;
+		values.corePowerWatts = record.corePowerWatts;
+		values.packagePowerWatts = record.packagePowerWatts;
+		values.coreEnergyJoules = record.coreEnergyJoules;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		after = record.sequence.load(std::memory_order_relaxed);
+	} while ((before & 0x1) || before != after);
+
+	return values;
+}
+
+// creates the named shared memory segment and publishes samples into it
+class TelemetryPublisher
+{
+public:
+	TelemetryPublisher(const std::string& name, int numCpus, double tscHz, const FabricClocks& fabricClocks);
+	virtual ~TelemetryPublisher();
+
+	TelemetryPublisher(const TelemetryPublisher&) = delete;
+	TelemetryPublisher& operator=(const TelemetryPublisher&) = delete;
+
+	// never blocks, readers that are in the middle of a read simply retry
+	void publish(const SystemSample& sample);
+
+private:
+	HANDLE mapping;
+	TelemetryHeader* header;
+	TelemetryRecord* records;
+};
+
+// samples every interval and publishes into the shared memory segment until Ctrl+C
+void runTelemetryExport(const std::string& name, int numThreads, DWORD intervalMs);
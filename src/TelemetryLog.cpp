@@ -0,0 +1,465 @@
+﻿#include "TelemetryLog.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "StopSignal.h"
+#include "Trace.h"
+#include "Tsc.h"
+
+// constants
+static constexpr uint32_t CHUNK_CAPACITY{ 1024 };
+
+struct CpuAggregate
+{
+	uint64_t aperf{ 0 };
+	uint64_t mperf{ 0 };
+	uint64_t energy{ 0 };
+	uint64_t pstateSamples[8]{};
+};
+
+struct BucketAggregate
+{
+	uint64_t samples{ 0 };
+	uint64_t packageEnergy{ 0 };
+	uint64_t aperf{ 0 };
+	uint64_t mperf{ 0 };
+	float minTemperature{ std::numeric_limits<float>::max() };
+	float maxTemperature{ std::numeric_limits<float>::lowest() };
+};
+
+// prototypes
+static uint64_t alignUp(uint64_t value, uint64_t alignment);
+static void printPstateResidency(const uint64_t pstateSamples[8]);
+
+TelemetryLogLayout getTelemetryLogLayout(uint32_t numCpus, uint32_t chunkCapacity)
+{
+	// every array starts on its own cache line
+	TelemetryLogLayout layout;
+	uint64_t offset = sizeof(TelemetryLogChunkHeader);
+	auto place = [&](uint64_t& field, uint64_t size) {
+		field = offset;
+		offset = alignUp(offset + size, 64);
+	};
+
+	place(layout.timestamps, sizeof(uint64_t) * chunkCapacity);
+	place(layout.temperatures, sizeof(float) * chunkCapacity);
+	place(layout.packageEnergy, sizeof(uint32_t) * chunkCapacity);
+	place(layout.aperf, sizeof(uint64_t) * chunkCapacity * numCpus);
+	place(layout.mperf, sizeof(uint64_t) * chunkCapacity * numCpus);
+	place(layout.coreEnergy, sizeof(uint32_t) * chunkCapacity * numCpus);
+	place(layout.pstates, sizeof(uint8_t) * chunkCapacity * numCpus);
+	layout.chunkSize = alignUp(offset, TELEMETRY_LOG_ALIGNMENT);
+
+	return layout;
+}
+
+TelemetryLogWriter::TelemetryLogWriter(const std::string& path, int numCpus, double tscHz, double energyUnit,
+	const FabricClocks& fabricClocks)
+	:mapping(nullptr), chunk(nullptr), header(), numChunks(0), sampleCount(0)
+{
+	file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		throw std::runtime_error("Failed to create telemetry log '" + path + "'");
+	}
+
+	layout = getTelemetryLogLayout(numCpus, CHUNK_CAPACITY);
+
+	header.magic = TELEMETRY_LOG_MAGIC;
+	header.version = TELEMETRY_LOG_VERSION;
+	header.numCpus = numCpus;
+	header.chunkCapacity = CHUNK_CAPACITY;
+	header.chunkSize = layout.chunkSize;
+	header.startTimestamp = readTsc();
+	header.tscHz = tscHz;
+	header.energyUnit = energyUnit;
+	header.fclkMhz = fabricClocks.fclkMhz;
+	header.uclkMhz = fabricClocks.uclkMhz;
+	header.memclkMhz = fabricClocks.memclkMhz;
+
+	// the header gets a region of its own, so every chunk starts at a mappable offset
+	std::vector<uint8_t> region(TELEMETRY_LOG_ALIGNMENT, 0);
+	std::memcpy(region.data(), &header, sizeof(header));
+
+	DWORD written;
+	if (!WriteFile(file, region.data(), (DWORD)region.size(), &written, nullptr) || written != region.size())
+	{
+		CloseHandle(file);
+		throw std::runtime_error("Failed to write telemetry log '" + path + "'");
+	}
+}
+
+TelemetryLogWriter::~TelemetryLogWriter()
+{
+	closeChunk();
+	CloseHandle(file);
+}
+
+void TelemetryLogWriter::append(const SystemSample& sample)
+{
+	if (!chunk || reinterpret_cast<TelemetryLogChunkHeader*>(chunk)->sampleCount == header.chunkCapacity)
+	{
+		startChunk();
+	}
+
+	TelemetryLogChunkHeader* chunkHeader = reinterpret_cast<TelemetryLogChunkHeader*>(chunk);
+	uint32_t index = chunkHeader->sampleCount;
+
+	reinterpret_cast<uint64_t*>(chunk + layout.timestamps)[index] = sample.timestamp;
+	reinterpret_cast<float*>(chunk + layout.temperatures)[index] = (float)sample.temperature;
+	reinterpret_cast<uint32_t*>(chunk + layout.packageEnergy)[index] = sample.packageEnergyDelta;
+
+	uint64_t* aperf = reinterpret_cast<uint64_t*>(chunk + layout.aperf);
+	uint64_t* mperf = reinterpret_cast<uint64_t*>(chunk + layout.mperf);
+	uint32_t* coreEnergy = reinterpret_cast<uint32_t*>(chunk + layout.coreEnergy);
+	uint8_t* pstates = chunk + layout.pstates;
+
+	for (const CpuSample& cpuSample : sample.cpus)
+	{
+		size_t offset = (size_t)cpuSample.cpu * header.chunkCapacity + index;
+		aperf[offset] = cpuSample.aperfDelta;
+		mperf[offset] = cpuSample.mperfDelta;
+		coreEnergy[offset] = cpuSample.coreEnergyDelta;
+		pstates[offset] = (uint8_t)cpuSample.pstate;
+	}
+
+	// the count is published last, a reader of the live file never sees a partial sample
+	std::atomic_thread_fence(std::memory_order_release);
+	chunkHeader->sampleCount = index + 1;
+	sampleCount++;
+}
+
+uint64_t TelemetryLogWriter::getSampleCount() const
+{
+	return sampleCount;
+}
+
+void TelemetryLogWriter::startChunk()
+{
+	TraceSpan span("startChunk", "chunk", numChunks);
+	closeChunk();
+
+	// the mapping grows the file to the end of the new chunk, the new space reads as zero
+	uint64_t offset = TELEMETRY_LOG_ALIGNMENT + numChunks * layout.chunkSize;
+	uint64_t end = offset + layout.chunkSize;
+
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, (DWORD)(end >> 32), (DWORD)end, nullptr);
+	if (!mapping)
+	{
+		throw std::runtime_error("Failed to grow the telemetry log");
+	}
+
+	chunk = static_cast<uint8_t*>(MapViewOfFile(mapping, FILE_MAP_WRITE, (DWORD)(offset >> 32), (DWORD)offset, (SIZE_T)layout.chunkSize));
+	if (!chunk)
+	{
+		CloseHandle(mapping);
+		mapping = nullptr;
+		throw std::runtime_error("Failed to map a telemetry log chunk");
+	}
+
+	reinterpret_cast<TelemetryLogChunkHeader*>(chunk)->magic = TELEMETRY_LOG_CHUNK_MAGIC;
+	numChunks++;
+}
+
+void TelemetryLogWriter::closeChunk()
+{
+	if (chunk)
+	{
+		UnmapViewOfFile(chunk);
+		chunk = nullptr;
+	}
+
+	if (mapping)
+	{
+		CloseHandle(mapping);
+		mapping = nullptr;
+	}
+}
+
+TelemetryLogReader::TelemetryLogReader(const std::string& path)
+{
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		throw std::runtime_error("Failed to open telemetry log '" + path + "'");
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || (uint64_t)size.QuadPart < TELEMETRY_LOG_ALIGNMENT)
+	{
+		CloseHandle(file);
+		throw std::runtime_error("'" + path + "' is not a telemetry log");
+	}
+	fileSize = size.QuadPart;
+
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	view = mapping ? static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+	if (!view)
+	{
+		if (mapping)
+		{
+			CloseHandle(mapping);
+		}
+		CloseHandle(file);
+		throw std::runtime_error("Failed to map telemetry log '" + path + "'");
+	}
+
+	const TelemetryLogHeader& header = getHeader();
+	if (header.magic != TELEMETRY_LOG_MAGIC || header.version != TELEMETRY_LOG_VERSION)
+	{
+		UnmapViewOfFile(view);
+		CloseHandle(mapping);
+		CloseHandle(file);
+		throw std::runtime_error("'" + path + "' is not a telemetry log of this version");
+	}
+
+	layout = getTelemetryLogLayout(header.numCpus, header.chunkCapacity);
+}
+
+TelemetryLogReader::~TelemetryLogReader()
+{
+	UnmapViewOfFile(view);
+	CloseHandle(mapping);
+	CloseHandle(file);
+}
+
+const TelemetryLogHeader& TelemetryLogReader::getHeader() const
+{
+	return *reinterpret_cast<const TelemetryLogHeader*>(view);
+}
+
+const TelemetryLogLayout& TelemetryLogReader::getLayout() const
+{
+	return layout;
+}
+
+uint64_t TelemetryLogReader::getNumChunks() const
+{
+	return (fileSize - TELEMETRY_LOG_ALIGNMENT) / layout.chunkSize;
+}
+
+const TelemetryLogChunkHeader* TelemetryLogReader::getChunk(uint64_t index) const
+{
+	const TelemetryLogChunkHeader* chunk = reinterpret_cast<const TelemetryLogChunkHeader*>(
+		view + TELEMETRY_LOG_ALIGNMENT + index * layout.chunkSize);
+
+	return chunk->magic == TELEMETRY_LOG_CHUNK_MAGIC ? chunk : nullptr;
+}
+
+void runTelemetryLog(const std::string& path, int numThreads, DWORD intervalMs, DWORD durationMs)
+{
+	PciSmnAccess smn;
+	Sampler sampler(numThreads, smn);
+	TelemetryLogWriter writer(path, numThreads, sampler.getTscFrequency(), sampler.getEnergyUnit(), tryReadFabricClocks(smn));
+
+	installStopHandler();
+	std::cout << "Logging telemetry of " << numThreads << " threads to '" << path
+		<< "' every " << intervalMs << " ms, press Ctrl+C to stop" << std::endl;
+
+	for (DWORD elapsed = 0; !isStopRequested() && (!durationMs || elapsed < durationMs); elapsed += intervalMs)
+	{
+		Sleep(intervalMs);
+		writer.append(sampler.sample());
+	}
+
+	removeStopHandler();
+	std::cout << "Logged " << writer.getSampleCount() << " samples" << std::endl;
+}
+
+void analyzeTelemetryLog(const std::string& path, double bucketSeconds)
+{
+	TraceSpan span("analyzeTelemetryLog");
+
+	TelemetryLogReader reader(path);
+	const TelemetryLogHeader& header = reader.getHeader();
+	const TelemetryLogLayout& layout = reader.getLayout();
+	uint64_t bucketTicks = std::max<uint64_t>((uint64_t)(bucketSeconds * header.tscHz), 1);
+
+	std::vector<CpuAggregate> cpus(header.numCpus);
+	std::vector<BucketAggregate> buckets;
+	uint64_t samples = 0;
+	uint64_t packageEnergy = 0;
+	uint64_t lastTimestamp = header.startTimestamp;
+
+	// all inner loops run over contiguous arrays without dependencies between iterations,
+	// so the compiler can vectorize them
+	for (uint64_t chunkIndex = 0; chunkIndex < reader.getNumChunks(); chunkIndex++)
+	{
+		const TelemetryLogChunkHeader* chunk = reader.getChunk(chunkIndex);
+		if (!chunk)
+		{
+			break;
+		}
+
+		uint32_t count = std::min(chunk->sampleCount, header.chunkCapacity);
+		const uint64_t* timestamps = reader.getArray<uint64_t>(chunk, layout.timestamps);
+		const float* temperatures = reader.getArray<float>(chunk, layout.temperatures);
+		const uint32_t* packageEnergies = reader.getArray<uint32_t>(chunk, layout.packageEnergy);
+		const uint64_t* aperf = reader.getArray<uint64_t>(chunk, layout.aperf);
+		const uint64_t* mperf = reader.getArray<uint64_t>(chunk, layout.mperf);
+		const uint32_t* coreEnergy = reader.getArray<uint32_t>(chunk, layout.coreEnergy);
+		const uint8_t* pstates = reader.getArray<uint8_t>(chunk, layout.pstates);
+
+		for (uint32_t cpu = 0; cpu < header.numCpus; cpu++)
+		{
+			size_t base = (size_t)cpu * header.chunkCapacity;
+			CpuAggregate& aggregate = cpus[cpu];
+			uint64_t aperfSum = 0;
+			uint64_t mperfSum = 0;
+			uint64_t energySum = 0;
+
+			for (uint32_t i = 0; i < count; i++)
+			{
+				aperfSum += aperf[base + i];
+				mperfSum += mperf[base + i];
+				energySum += coreEnergy[base + i];
+			}
+
+			for (uint32_t i = 0; i < count; i++)
+			{
+				aggregate.pstateSamples[pstates[base + i] & 0x7]++;
+			}
+
+			aggregate.aperf += aperfSum;
+			aggregate.mperf += mperfSum;
+			aggregate.energy += energySum;
+		}
+
+		// timestamps are ascending, so every bucket is a contiguous range of samples
+		for (uint32_t first = 0, last; first < count; first = last)
+		{
+			size_t index = (size_t)((timestamps[first] - header.startTimestamp) / bucketTicks);
+			uint64_t bucketEnd = header.startTimestamp + (index + 1) * bucketTicks;
+			for (last = first; last < count && timestamps[last] < bucketEnd; last++)
+			{
+			}
+
+			if (buckets.size() <= index)
+			{
+				buckets.resize(index + 1);
+			}
+
+			BucketAggregate& bucket = buckets[index];
+			bucket.samples += last - first;
+
+			// a bucket can span chunks, so the total only gets the energy of this range
+			uint64_t rangeEnergy = 0;
+			for (uint32_t i = first; i < last; i++)
+			{
+				rangeEnergy += packageEnergies[i];
+				bucket.minTemperature = std::min(bucket.minTemperature, temperatures[i]);
+				bucket.maxTemperature = std::max(bucket.maxTemperature, temperatures[i]);
+			}
+
+			for (uint32_t cpu = 0; cpu < header.numCpus; cpu++)
+			{
+				size_t base = (size_t)cpu * header.chunkCapacity;
+				for (uint32_t i = first; i < last; i++)
+				{
+					bucket.aperf += aperf[base + i];
+					bucket.mperf += mperf[base + i];
+				}
+			}
+
+			bucket.packageEnergy += rangeEnergy;
+			packageEnergy += rangeEnergy;
+		}
+
+		samples += count;
+		if (count)
+		{
+			lastTimestamp = timestamps[count - 1];
+		}
+	}
+
+	double durationSeconds = (lastTimestamp - header.startTimestamp) / header.tscHz;
+	std::cout << "Samples: " << samples << " of " << header.numCpus << " threads over "
+		<< std::fixed << std::setprecision(1) << durationSeconds << " s, package "
+		<< (durationSeconds > 0 ? packageEnergy * header.energyUnit / durationSeconds : 0) << " W average" << std::endl;
+	std::cout << std::setprecision(0) << "FCLK " << header.fclkMhz << " MHz, UCLK " << header.uclkMhz
+		<< " MHz, MEMCLK " << header.memclkMhz << " MHz (0: unknown)\n" << std::endl;
+
+	if (!samples || durationSeconds <= 0)
+	{
+		std::cout << std::defaultfloat;
+		return;
+	}
+
+	std::cout << std::left << std::setw(6) << "CPU"
+		<< std::setw(10) << "MHz"
+		<< std::setw(10) << "Busy %"
+		<< std::setw(10) << "Power W"
+		<< "Pstate residency %" << std::endl;
+
+	for (uint32_t cpu = 0; cpu < header.numCpus; cpu++)
+	{
+		const CpuAggregate& aggregate = cpus[cpu];
+		std::cout << std::setw(6) << cpu << std::setprecision(0)
+			<< std::setw(10) << (aggregate.mperf ? header.tscHz * aggregate.aperf / aggregate.mperf / 1e6 : 0)
+			<< std::setprecision(1)
+			<< std::setw(10) << aggregate.mperf * 100 / header.tscHz / durationSeconds
+			<< std::setw(10) << aggregate.energy * header.energyUnit / durationSeconds;
+		printPstateResidency(aggregate.pstateSamples);
+		std::cout << std::endl;
+	}
+
+	std::cout << "\n" << std::setw(10) << "Time s"
+		<< std::setw(10) << "Samples"
+		<< std::setw(12) << "Package W"
+		<< std::setw(10) << "MHz"
+		<< std::setw(10) << "Busy %"
+		<< "Temperature C" << std::endl;
+
+	for (size_t index = 0; index < buckets.size(); index++)
+	{
+		const BucketAggregate& bucket = buckets[index];
+		// the last bucket usually ends early
+		double seconds = std::min(bucketSeconds, (lastTimestamp - header.startTimestamp - index * bucketTicks) / header.tscHz);
+		if (!bucket.samples || seconds <= 0)
+		{
+			continue;
+		}
+
+		std::cout << std::setprecision(1) << std::setw(10) << index * bucketSeconds
+			<< std::setw(10) << bucket.samples
+			<< std::setw(12) << bucket.packageEnergy * header.energyUnit / seconds
+			<< std::setprecision(0)
+			<< std::setw(10) << (bucket.mperf ? header.tscHz * bucket.aperf / bucket.mperf / 1e6 : 0)
+			<< std::setprecision(1)
+			<< std::setw(10) << bucket.mperf * 100 / header.tscHz / seconds / header.numCpus
+			<< bucket.minTemperature << " - " << bucket.maxTemperature << std::endl;
+	}
+
+	std::cout << std::defaultfloat << std::right;
+}
+
+static uint64_t alignUp(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+static void printPstateResidency(const uint64_t pstateSamples[8])
+{
+	uint64_t total = 0;
+	for (int pstate = 0; pstate < 8; pstate++)
+	{
+		total += pstateSamples[pstate];
+	}
+
+	for (int pstate = 0; pstate < 8 && total; pstate++)
+	{
+		if (pstateSamples[pstate])
+		{
+			std::cout << "P" << pstate << ":" << pstateSamples[pstate] * 100.0 / total << " ";
+		}
+	}
+}
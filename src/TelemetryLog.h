@@ -0,0 +1,120 @@
+﻿#pragma once
+#include <cstdint>
+#include <string>
+
+#include <Windows.h>
+
+#include "FabricClock.h"
+#include "Sampler.h"
+
+// binary append only telemetry log
+// [TelemetryLogHeader, padded to 64 KiB][chunk][chunk]...
+// every chunk has a fixed size (a multiple of 64 KiB, so it can be mapped on its own) and stores
+// up to chunkCapacity samples as arrays, one array per field and cpu, so aggregating a field of a
+// cpu is a loop over contiguous memory
+
+static constexpr uint32_t TELEMETRY_LOG_MAGIC{ 0x474C5052 }; // "RPLG"
+static constexpr uint32_t TELEMETRY_LOG_CHUNK_MAGIC{ 0x4B4E4843 }; // "CHNK"
+static constexpr uint32_t TELEMETRY_LOG_VERSION{ 2 };
+static constexpr uint64_t TELEMETRY_LOG_ALIGNMENT{ 64 * 1024 }; // allocation granularity of file views
+
+struct TelemetryLogHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t numCpus;
+	uint32_t chunkCapacity; // samples per chunk
+	uint64_t chunkSize; // bytes per chunk
+	uint64_t startTimestamp; // TSC at which the first sample interval started
+	double tscHz;
+	double energyUnit; // joules per energy count
+	// read once when logging starts, 0 if unknown
+	double fclkMhz;
+	double uclkMhz;
+	double memclkMhz;
+};
+
+struct alignas(64) TelemetryLogChunkHeader
+{
+	uint32_t magic;
+	uint32_t sampleCount; // only samples below this count are complete
+};
+
+// offsets of the arrays within a chunk, cpu arrays are indexed [cpu * chunkCapacity + sample]
+struct TelemetryLogLayout
+{
+	uint64_t timestamps; // uint64_t TSC
+	uint64_t temperatures; // float degrees celsius
+	uint64_t packageEnergy; // uint32_t counts
+	uint64_t aperf; // uint64_t deltas
+	uint64_t mperf; // uint64_t deltas
+	uint64_t coreEnergy; // uint32_t counts
+	uint64_t pstates; // uint8_t
+	uint64_t chunkSize;
+};
+
+TelemetryLogLayout getTelemetryLogLayout(uint32_t numCpus, uint32_t chunkCapacity);
+
+// appends samples to a new log file, every chunk is mapped while it is being filled
+class TelemetryLogWriter
+{
+public:
+	TelemetryLogWriter(const std::string& path, int numCpus, double tscHz, double energyUnit, const FabricClocks& fabricClocks);
+	virtual ~TelemetryLogWriter();
+
+	TelemetryLogWriter(const TelemetryLogWriter&) = delete;
+	TelemetryLogWriter& operator=(const TelemetryLogWriter&) = delete;
+
+	void append(const SystemSample& sample);
+
+	uint64_t getSampleCount() const;
+
+private:
+	HANDLE file;
+	HANDLE mapping;
+	uint8_t* chunk;
+	TelemetryLogHeader header;
+	TelemetryLogLayout layout;
+	uint64_t numChunks;
+	uint64_t sampleCount;
+
+	void startChunk();
+	void closeChunk();
+};
+
+// maps a complete log file read only
+class TelemetryLogReader
+{
+public:
+	explicit TelemetryLogReader(const std::string& path);
+	virtual ~TelemetryLogReader();
+
+	TelemetryLogReader(const TelemetryLogReader&) = delete;
+	TelemetryLogReader& operator=(const TelemetryLogReader&) = delete;
+
+	const TelemetryLogHeader& getHeader() const;
+	const TelemetryLogLayout& getLayout() const;
+	uint64_t getNumChunks() const;
+
+	// nullptr if the chunk was never started
+	const TelemetryLogChunkHeader* getChunk(uint64_t index) const;
+
+	template <typename T>
+	const T* getArray(const TelemetryLogChunkHeader* chunk, uint64_t offset) const
+	{
+		return reinterpret_cast<const T*>(reinterpret_cast<const uint8_t*>(chunk) + offset);
+	}
+
+private:
+	HANDLE file;
+	HANDLE mapping;
+	const uint8_t* view;
+	uint64_t fileSize;
+	TelemetryLogLayout layout;
+};
+
+// samples every interval and appends to the log until Ctrl+C or the duration (0: unlimited) is over
+void runTelemetryLog(const std::string& path, int numThreads, DWORD intervalMs, DWORD durationMs);
+
+// prints per cpu and per time bucket aggregates of a log
+void analyzeTelemetryLog(const std::string& path, double bucketSeconds);
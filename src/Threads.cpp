@@ -0,0 +1,112 @@
+﻿#include "Threads.h"
+
+#include <sstream>
+#include <stdexcept>
+
+DWORD_PTR getAllThreadsMask(int numThreads)
+{
+	DWORD_PTR maxMask = -1; // initialize all bits to one
+	return maxMask >> (sizeof(DWORD_PTR) * 8 - numThreads);
+}
+
+DWORD_PTR parseThreadMask(const std::string& threadList, int numThreads)
+{
+	if (threadList.empty())
+	{
+		return getAllThreadsMask(numThreads);
+	}
+
+	DWORD_PTR mask = 0;
+	std::istringstream listStream(threadList);
+	std::string range;
+
+	while (std::getline(listStream, range, ','))
+	{
+		int first;
+		int last;
+		char separator;
+		std::istringstream rangeStream(range);
+
+		if (!(rangeStream >> first))
+		{
+			throw std::invalid_argument("Invalid thread list '" + threadList + "'");
+		}
+
+		if (rangeStream >> separator)
+		{
+			if (separator != '-' || !(rangeStream >> last))
+			{
+				throw std::invalid_argument("Invalid thread list '" + threadList + "'");
+			}
+		}
+		else
+		{
+			last = first;
+		}
+
+		if (first < 0 || last >= numThreads || first > last)
+		{
+			std::ostringstream errorMessage;
+			errorMessage << "Thread range '" << range << "' out of bounds "
+				"(must be between 0 and " << numThreads - 1 << ")";
+			throw std::invalid_argument(errorMessage.str());
+		}
+
+		for (int thread = first; thread <= last; thread++)
+		{
+			mask |= (DWORD_PTR)1 << thread;
+		}
+	}
+
+	return mask;
+}
+
+std::string formatThreadList(DWORD_PTR mask)
+{
+	std::ostringstream list;
+	std::vector<int> threads = getThreadsInMask(mask);
+
+	for (size_t i = 0; i < threads.size(); i++)
+	{
+		// extend the range as long as the following threads are consecutive
+		size_t last = i;
+		while (last + 1 < threads.size() && threads[last + 1] == threads[last] + 1)
+		{
+			last++;
+		}
+
+		list << (i ? "," : "") << threads[i];
+		if (last > i)
+		{
+			list << "-" << threads[last];
+		}
+		i = last;
+	}
+
+	return list.str();
+}
+
+std::vector<int> getThreadsInMask(DWORD_PTR mask)
+{
+	std::vector<int> threads;
+
+	for (int thread = 0; thread < sizeof(DWORD_PTR) * 8; thread++)
+	{
+		if (mask >> thread & 0x1)
+		{
+			threads.push_back(thread);
+		}
+	}
+
+	return threads;
+}
+
+void pinCurrentThread(int thread)
+{
+	if (!SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << thread))
+	{
+		std::ostringstream errorMessage;
+		errorMessage << "Failed to pin thread to hardware thread " << thread;
+		throw std::runtime_error(errorMessage.str());
+	}
+}
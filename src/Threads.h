@@ -0,0 +1,21 @@
+﻿#pragma once
+#include <string>
+#include <vector>
+
+#include <Windows.h>
+
+// affinity mask with one bit set for every hardware thread in the system
+DWORD_PTR getAllThreadsMask(int numThreads);
+
+// parses a thread list like "0-3,8,10" into an affinity mask
+// an empty list selects all threads
+DWORD_PTR parseThreadMask(const std::string& threadList, int numThreads);
+
+// formats an affinity mask as a thread list like "0-3,8,10", the inverse of parseThreadMask
+std::string formatThreadList(DWORD_PTR mask);
+
+// returns the indices of all threads selected by the mask in ascending order
+std::vector<int> getThreadsInMask(DWORD_PTR mask);
+
+// restricts the calling thread to a single hardware thread
+void pinCurrentThread(int thread);
@@ -0,0 +1,77 @@
+﻿#include "Topology.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include "Threads.h"
+
+std::vector<CoreInfo> getCores(int numThreads)
+{
+	DWORD length = 0;
+	GetLogicalProcessorInformation(nullptr, &length);
+	if (GetLastError() != ERROR_INSUFFICIENT_BUFFER)
+	{
+		throw std::runtime_error("Failed to query the processor topology");
+	}
+
+	std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> entries(length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+	if (!GetLogicalProcessorInformation(entries.data(), &length))
+	{
+		throw std::runtime_error("Failed to query the processor topology");
+	}
+
+	DWORD_PTR allThreadsMask = getAllThreadsMask(numThreads);
+	std::vector<CoreInfo> cores;
+	std::vector<DWORD_PTR> l3Masks;
+
+	for (const SYSTEM_LOGICAL_PROCESSOR_INFORMATION& entry : entries)
+	{
+		if (entry.Relationship == RelationProcessorCore && (entry.ProcessorMask & allThreadsMask))
+		{
+			CoreInfo core;
+			core.threadMask = entry.ProcessorMask & allThreadsMask;
+			cores.push_back(core);
+		}
+		else if (entry.Relationship == RelationCache && entry.Cache.Level == 3)
+		{
+			l3Masks.push_back(entry.ProcessorMask);
+		}
+	}
+
+	// the OS doesn't guarantee any order, sort by the lowest thread of each core and L3
+	std::sort(l3Masks.begin(), l3Masks.end(), [](DWORD_PTR a, DWORD_PTR b) {
+		return (a & (~a + 1)) < (b & (~b + 1));
+	});
+	std::sort(cores.begin(), cores.end(), [](const CoreInfo& a, const CoreInfo& b) {
+		return getThreadsInMask(a.threadMask).front() < getThreadsInMask(b.threadMask).front();
+	});
+
+	for (size_t i = 0; i < cores.size(); i++)
+	{
+		cores[i].core = (int)i;
+		for (size_t l3 = 0; l3 < l3Masks.size(); l3++)
+		{
+			if (cores[i].threadMask & l3Masks[l3])
+			{
+				cores[i].ccx = (int)l3;
+				break;
+			}
+		}
+	}
+
+	return cores;
+}
+
+int getCoreOfThread(const std::vector<CoreInfo>& cores, int thread)
+{
+	for (const CoreInfo& core : cores)
+	{
+		if (core.threadMask >> thread & 0x1)
+		{
+			return core.core;
+		}
+	}
+
+	throw std::invalid_argument("Thread " + std::to_string(thread) + " doesn't belong to any core");
+}
@@ -0,0 +1,17 @@
+﻿#pragma once
+#include <vector>
+
+#include <Windows.h>
+
+struct CoreInfo
+{
+	int core{ 0 };
+	int ccx{ 0 }; // cores sharing an L3 cache
+	DWORD_PTR threadMask{ 0 }; // all SMT threads of the core
+};
+
+// physical cores and their L3 groups as reported by the OS, ordered by their first thread
+std::vector<CoreInfo> getCores(int numThreads);
+
+// index of the core a hardware thread belongs to
+int getCoreOfThread(const std::vector<CoreInfo>& cores, int thread);
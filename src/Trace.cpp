@@ -0,0 +1,80 @@
+﻿#include "Trace.h"
+
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include <Windows.h>
+
+struct TraceEvent
+{
+	const char* name;
+	const char* argName;
+	uint64_t argValue;
+	double start;
+	double duration;
+	DWORD threadId;
+};
+
+bool traceEnabled{ false };
+
+static std::mutex traceMutex;
+static std::vector<TraceEvent> traceEvents;
+static LARGE_INTEGER traceFrequency;
+static LARGE_INTEGER traceOrigin;
+
+void enableTracing()
+{
+	QueryPerformanceFrequency(&traceFrequency);
+	QueryPerformanceCounter(&traceOrigin);
+	traceEvents.reserve(4096);
+	traceEnabled = true;
+}
+
+void writeTrace(const std::string& path)
+{
+	std::ofstream file(path);
+	if (!file)
+	{
+		throw std::runtime_error("Failed to open trace file '" + path + "'");
+	}
+
+	std::lock_guard<std::mutex> lock(traceMutex);
+	DWORD processId = GetCurrentProcessId();
+
+	// the timestamps are in microseconds, the default precision would round them to 10 us after a few seconds
+	file << std::fixed << std::setprecision(3);
+	file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+	for (size_t i = 0; i < traceEvents.size(); i++)
+	{
+		const TraceEvent& event = traceEvents[i];
+		file << (i ? ",\n" : "\n")
+			<< "{\"name\":\"" << event.name << "\",\"ph\":\"X\""
+			<< ",\"ts\":" << event.start << ",\"dur\":" << event.duration
+			<< ",\"pid\":" << processId << ",\"tid\":" << event.threadId;
+		if (event.argName)
+		{
+			file << ",\"args\":{\"" << event.argName << "\":" << event.argValue << "}";
+		}
+		file << "}";
+	}
+	file << "\n]}" << std::endl;
+}
+
+double TraceSpan::traceTimestamp()
+{
+	// microseconds since tracing was enabled, the unit of the trace event format
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return (double)(now.QuadPart - traceOrigin.QuadPart) * 1e6 / traceFrequency.QuadPart;
+}
+
+void TraceSpan::record() const
+{
+	TraceEvent event{ name, argName, argValue, start, traceTimestamp() - start, GetCurrentThreadId() };
+
+	std::lock_guard<std::mutex> lock(traceMutex);
+	traceEvents.push_back(event);
+}
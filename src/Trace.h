@@ -0,0 +1,48 @@
+﻿#pragma once
+#include <cstdint>
+#include <string>
+
+// phase level tracing in Chrome trace event format (chrome://tracing, Perfetto)
+// when tracing is disabled a span only costs a check of a global flag
+
+extern bool traceEnabled;
+
+void enableTracing();
+
+// writes all recorded spans to a JSON file
+void writeTrace(const std::string& path);
+
+// times the scope it lives in, the span is recorded when it goes out of scope
+class TraceSpan
+{
+public:
+	explicit TraceSpan(const char* name, const char* argName = nullptr, uint64_t argValue = 0)
+		: name(name), argName(argName), argValue(argValue), active(traceEnabled)
+	{
+		if (active)
+		{
+			start = traceTimestamp();
+		}
+	}
+
+	~TraceSpan()
+	{
+		if (active)
+		{
+			record();
+		}
+	}
+
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+	const char* name;
+	const char* argName;
+	uint64_t argValue;
+	bool active;
+	double start{ 0 };
+
+	static double traceTimestamp();
+	void record() const;
+};
@@ -0,0 +1,57 @@
+﻿#include "Tsc.h"
+
+#include "Msr.h"
+#include "Trace.h"
+
+// support GCC and MS VC++ compilers
+#if defined(__GNUC__)
+#include <x86intrin.h>
+#elif defined (_WIN32)
+#include <intrin.h>
+#endif
+
+// constants
+static constexpr unsigned int HWCONF_REGISTER{ 0xC0010015 };
+static constexpr uint64_t LOCK_TSC_TO_CURRENT_P0{ 1 << 21 };
+static constexpr DWORD CALIBRATION_PERIOD_MS{ 100 };
+
+uint64_t readTsc()
+{
+	return __rdtsc();
+}
+
+double calibrateTscFrequency()
+{
+	TraceSpan span("calibrateTscFrequency");
+	LARGE_INTEGER qpcFrequency;
+	LARGE_INTEGER qpcStart;
+	LARGE_INTEGER qpcEnd;
+	QueryPerformanceFrequency(&qpcFrequency);
+
+	QueryPerformanceCounter(&qpcStart);
+	uint64_t tscStart = readTsc();
+	Sleep(CALIBRATION_PERIOD_MS);
+	QueryPerformanceCounter(&qpcEnd);
+	uint64_t tscEnd = readTsc();
+
+	double seconds = (double)(qpcEnd.QuadPart - qpcStart.QuadPart) / qpcFrequency.QuadPart;
+	return (tscEnd - tscStart) / seconds;
+}
+
+bool lockTsc(DWORD_PTR mask)
+{
+	TraceSpan span("lockTsc", "mask", mask);
+	uint64_t hwcr = readMsr(HWCONF_REGISTER, mask);
+	if (hwcr & LOCK_TSC_TO_CURRENT_P0)
+	{
+		return false;
+	}
+
+	writeMsr(HWCONF_REGISTER, hwcr | LOCK_TSC_TO_CURRENT_P0, mask);
+	return true;
+}
+
+bool isTscLocked(DWORD_PTR mask)
+{
+	return (readMsr(HWCONF_REGISTER, mask) & LOCK_TSC_TO_CURRENT_P0) != 0;
+}
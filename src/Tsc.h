@@ -0,0 +1,18 @@
+﻿#pragma once
+#include <cstdint>
+
+#include <Windows.h>
+
+// reads the time stamp counter of the calling thread
+uint64_t readTsc();
+
+// measures the TSC frequency (in Hz) against the performance counter of the OS
+double calibrateTscFrequency();
+
+// sets LockTscToCurrentP0 in HWCR on the thread(s) selected by the mask
+// required when pstate 0 changes, otherwise the TSC frequency would follow the new P0 frequency
+// HWCR is only written if the bit isn't set yet, returns true if it was written
+bool lockTsc(DWORD_PTR mask);
+
+// checks LockTscToCurrentP0 in HWCR on the thread selected by the mask
+bool isTscLocked(DWORD_PTR mask);
@@ -0,0 +1,178 @@
+﻿#include "TscCheck.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include "Threads.h"
+#include "Trace.h"
+#include "Tsc.h"
+
+int64_t measureTscSkew(int referenceThread, int thread, int iterations)
+{
+	TraceSpan span("measureTscSkew", "thread", thread);
+	// a zero value means "empty", TSC values are never zero on a running system
+	std::atomic<uint64_t> request{ 0 };
+	std::atomic<uint64_t> response{ 0 };
+	std::atomic<bool> aborted{ false };
+	std::exception_ptr error;
+
+	int64_t lowerBound = std::numeric_limits<int64_t>::min();
+	int64_t upperBound = std::numeric_limits<int64_t>::max();
+
+	// both sides run on their own pinned thread, so the affinity of the caller is left alone
+	auto pinOrAbort = [&](int target) {
+		try
+		{
+			pinCurrentThread(target);
+			return true;
+		}
+		catch (...)
+		{
+			if (!aborted.exchange(true))
+			{
+				error = std::current_exception();
+			}
+			return false;
+		}
+	};
+
+	std::thread responder([&]() {
+		if (!pinOrAbort(thread))
+		{
+			return;
+		}
+
+		for (int i = 0; i < iterations && !aborted; i++)
+		{
+			while (request.load(std::memory_order_acquire) == 0 && !aborted)
+			{
+			}
+			request.store(0, std::memory_order_relaxed);
+			response.store(readTsc(), std::memory_order_release);
+		}
+	});
+
+	std::thread initiator([&]() {
+		if (!pinOrAbort(referenceThread))
+		{
+			return;
+		}
+
+		for (int i = 0; i < iterations && !aborted; i++)
+		{
+			uint64_t sent = readTsc();
+			request.store(sent, std::memory_order_release);
+
+			uint64_t remote;
+			while ((remote = response.load(std::memory_order_acquire)) == 0 && !aborted)
+			{
+			}
+			uint64_t received = readTsc();
+			response.store(0, std::memory_order_relaxed);
+
+			// the remote timestamp was taken between sent and received on our clock
+			lowerBound = std::max(lowerBound, (int64_t)(remote - received));
+			upperBound = std::min(upperBound, (int64_t)(remote - sent));
+		}
+	});
+
+	initiator.join();
+	responder.join();
+
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
+
+	return lowerBound / 2 + upperBound / 2;
+}
+
+TscCheckResult checkTsc(int numThreads, const TscCheckOptions& options)
+{
+	TscCheckResult result;
+	std::ostringstream failure;
+
+	result.frequencyHz = calibrateTscFrequency();
+
+	if (options.expectedHz)
+	{
+		double deviation = std::abs(result.frequencyHz - *options.expectedHz) / *options.expectedHz;
+		if (deviation > options.rateTolerance)
+		{
+			failure << "TSC rate " << result.frequencyHz / 1e6 << " MHz deviates " << deviation * 100
+				<< "% from the expected " << *options.expectedHz / 1e6 << " MHz";
+			result.failures.push_back(failure.str());
+			failure.str("");
+		}
+	}
+
+	result.skewTicks.push_back(0);
+	for (int thread = 1; thread < numThreads; thread++)
+	{
+		int64_t skew = measureTscSkew(0, thread, options.skewIterations);
+		result.skewTicks.push_back(skew);
+
+		if (std::abs(skew) > options.maxSkewTicks)
+		{
+			failure << "TSC of thread " << thread << " is skewed by " << skew
+				<< " ticks relative to thread 0 (limit " << options.maxSkewTicks << ")";
+			result.failures.push_back(failure.str());
+			failure.str("");
+		}
+	}
+
+	for (int thread = 0; thread < numThreads && options.requireLock; thread++)
+	{
+		if (!isTscLocked((DWORD_PTR)1 << thread))
+		{
+			result.unlockedThreads.push_back(thread);
+			failure << "LockTscToCurrentP0 is not set on thread " << thread;
+			result.failures.push_back(failure.str());
+			failure.str("");
+		}
+	}
+
+	return result;
+}
+
+void printTscCheckResult(const TscCheckResult& result)
+{
+	int64_t maxSkew = 0;
+	for (int64_t skew : result.skewTicks)
+	{
+		maxSkew = std::max(maxSkew, std::abs(skew));
+	}
+
+	std::cout << "TSC frequency (MHz): " << result.frequencyHz / 1e6
+		<< "\nMax TSC skew (ticks): " << maxSkew
+		<< "\nThreads without TSC lock: " << result.unlockedThreads.size() << std::endl;
+
+	for (const std::string& failure : result.failures)
+	{
+		std::cerr << "Error: " << failure << std::endl;
+	}
+}
+
+void verifyTsc(int numThreads, const TscCheckOptions& options)
+{
+	TraceSpan span("verifyTsc");
+	TscCheckResult result = checkTsc(numThreads, options);
+	printTscCheckResult(result);
+
+	if (!result.failures.empty())
+	{
+		std::ostringstream errorMessage;
+		errorMessage << "TSC verification failed (" << result.failures.size() << " problem(s))";
+		throw std::runtime_error(errorMessage.str());
+	}
+
+	std::cout << "TSC verification passed" << std::endl;
+}
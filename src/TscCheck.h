@@ -0,0 +1,35 @@
+﻿#pragma once
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct TscCheckOptions
+{
+	std::optional<double> expectedHz; // without an expected rate only skew and lock bits are checked
+	double rateTolerance{ 0.001 }; // relative, 0.1%
+	int64_t maxSkewTicks{ 1000 };
+	int skewIterations{ 1000 };
+	bool requireLock{ true };
+};
+
+struct TscCheckResult
+{
+	double frequencyHz{ 0 };
+	std::vector<int64_t> skewTicks; // per thread, relative to thread 0
+	std::vector<int> unlockedThreads;
+	std::vector<std::string> failures;
+};
+
+// estimates the TSC offset of a thread relative to a reference thread with a pinned ping-pong
+// the offset lies between the smallest round trip bounds seen in all iterations
+int64_t measureTscSkew(int referenceThread, int thread, int iterations);
+
+// calibrates the TSC rate, measures the skew of every thread against thread 0 and checks
+// that LockTscToCurrentP0 is set on every thread
+TscCheckResult checkTsc(int numThreads, const TscCheckOptions& options);
+
+void printTscCheckResult(const TscCheckResult& result);
+
+// runs checkTsc and throws a std::runtime_error listing every failure
+void verifyTsc(int numThreads, const TscCheckOptions& options);
@@ -0,0 +1,200 @@
+﻿#include "VfCurve.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <tuple>
+
+#include "PowerState.h"
+#include "Sensitivity.h"
+
+FrequencySetting findFrequencySetting(double targetMhz)
+{
+	FrequencySetting best;
+	double bestError = INFINITY;
+
+	// the lowest divider wins a tie, it has the finest FID steps
+	for (unsigned int did = PowerState::DID_MIN; did <= PowerState::DID_MAX; did++)
+	{
+		// frequency = 200 MHz * FID / DID
+		double fid = std::round(targetMhz * did / 200);
+		fid = std::min(std::max(fid, (double)PowerState::FID_MIN), (double)PowerState::FID_MAX);
+
+		double frequencyMhz = PowerState::calculateFrequency((uint8_t)fid, (uint8_t)did);
+		if (std::abs(frequencyMhz - targetMhz) < bestError)
+		{
+			bestError = std::abs(frequencyMhz - targetMhz);
+			best.fid = (uint8_t)fid;
+			best.did = (uint8_t)did;
+			best.frequencyMhz = frequencyMhz;
+		}
+	}
+
+	return best;
+}
+
+VfCurve::VfCurve(const std::vector<VfPoint>& stablePoints, const std::vector<VfPoint>& unstablePoints)
+	:points(stablePoints), unstablePoints(unstablePoints)
+{
+	if (points.empty())
+	{
+		throw std::runtime_error("No stable voltage/frequency points known");
+	}
+
+	std::sort(points.begin(), points.end(), [](const VfPoint& a, const VfPoint& b) {
+		return a.frequencyMhz != b.frequencyMhz ? a.frequencyMhz < b.frequencyMhz : a.vcore < b.vcore;
+	});
+
+	// a point is dominated if a higher (or the same) frequency is known to be stable at the same
+	// or a lower voltage, walking down from the top keeps the lowest stable voltage envelope.
+	// walking down, points of the same frequency come in descending voltage, so the last one
+	// replaces the others. two points at one frequency would make a segment of zero width
+	std::vector<VfPoint> envelope;
+	for (auto point = points.rbegin(); point != points.rend(); ++point)
+	{
+		if (!envelope.empty() && point->frequencyMhz == envelope.back().frequencyMhz)
+		{
+			envelope.back() = *point;
+		}
+		else if (envelope.empty() || point->vcore < envelope.back().vcore)
+		{
+			envelope.push_back(*point);
+		}
+	}
+
+	points.assign(envelope.rbegin(), envelope.rend());
+}
+
+double VfCurve::predictVcore(double frequencyMhz) const
+{
+	if (frequencyMhz <= points.front().frequencyMhz)
+	{
+		return points.front().vcore;
+	}
+
+	for (size_t i = 1; i < points.size(); i++)
+	{
+		if (frequencyMhz <= points[i].frequencyMhz)
+		{
+			const VfPoint& low = points[i - 1];
+			const VfPoint& high = points[i];
+			return low.vcore + (high.vcore - low.vcore) * (frequencyMhz - low.frequencyMhz) / (high.frequencyMhz - low.frequencyMhz);
+		}
+	}
+
+	if (points.size() < 2)
+	{
+		throw std::runtime_error("At least two points with different voltages are needed to extrapolate the curve");
+	}
+
+	// above the highest known point the slope of the last segment continues
+	const VfPoint& low = points[points.size() - 2];
+	const VfPoint& high = points.back();
+	return high.vcore + (high.vcore - low.vcore) * (frequencyMhz - high.frequencyMhz) / (high.frequencyMhz - low.frequencyMhz);
+}
+
+VfPrediction VfCurve::predict(double targetMhz, double margin) const
+{
+	VfPrediction prediction;
+	prediction.setting = findFrequencySetting(targetMhz);
+	prediction.predictedVcore = predictVcore(prediction.setting.frequencyMhz);
+	prediction.safeVcore = prediction.predictedVcore + margin;
+	prediction.extrapolated = prediction.setting.frequencyMhz > points.back().frequencyMhz;
+
+	// a voltage that failed at this or a lower frequency will fail here as well
+	for (const VfPoint& unstable : unstablePoints)
+	{
+		if (unstable.frequencyMhz <= prediction.setting.frequencyMhz && prediction.safeVcore <= unstable.vcore)
+		{
+			prediction.safeVcore = unstable.vcore + margin;
+		}
+	}
+
+	int vid = PowerState::calculateVid(prediction.safeVcore);
+	if (vid < PowerState::VID_MIN)
+	{
+		std::ostringstream errorMessage;
+		errorMessage << prediction.setting.frequencyMhz << " MHz needs about " << prediction.safeVcore
+			<< " V, more than the VID limit allows (" << PowerState::calculateVcore(PowerState::VID_MIN) << " V)";
+		throw std::runtime_error(errorMessage.str());
+	}
+
+	// below the lowest allowed voltage we simply use the lowest one
+	prediction.vid = (uint8_t)std::min(vid, (int)PowerState::VID_MAX);
+	prediction.safeVcore = PowerState::calculateVcore(prediction.vid);
+
+	return prediction;
+}
+
+void VfCurve::print() const
+{
+	std::cout << "Voltage/frequency curve:\n" << std::left
+		<< std::setw(10) << "MHz" << std::setw(10) << "VCore" << "Source" << std::endl;
+
+	for (const VfPoint& point : points)
+	{
+		std::cout << std::setw(10) << point.frequencyMhz << std::setw(10) << point.vcore << point.source << std::endl;
+	}
+
+	for (const VfPoint& point : unstablePoints)
+	{
+		std::cout << std::setw(10) << point.frequencyMhz << std::setw(10) << point.vcore << point.source << " (unstable)" << std::endl;
+	}
+
+	std::cout << std::right;
+}
+
+VfCurve buildVfCurve(const CertificationDatabase& certifications)
+{
+	std::vector<VfPoint> stablePoints;
+	std::vector<VfPoint> unstablePoints;
+
+	for (const OperatingPoint& point : getEnabledOperatingPoints())
+	{
+		stablePoints.push_back({ PowerState::calculateFrequency(point.fid, point.did), PowerState::calculateVcore(point.vid), point.name });
+	}
+
+	// only the latest record of every definition counts, like for the apply check
+	std::set<std::tuple<int, unsigned int, unsigned int, unsigned int>> seen;
+	const std::vector<CertificationRecord>& records = certifications.getRecords();
+
+	for (auto record = records.rbegin(); record != records.rend(); ++record)
+	{
+		if (!seen.insert({ record->pstate, record->fid, record->did, record->vid }).second)
+		{
+			continue;
+		}
+
+		VfPoint point{ PowerState::calculateFrequency(record->fid, record->did), PowerState::calculateVcore(record->vid),
+			formatCertificationResult(record->result) };
+
+		if (record->result == CertificationResult::PASSED)
+		{
+			stablePoints.push_back(point);
+		}
+		else
+		{
+			unstablePoints.push_back(point);
+		}
+	}
+
+	return VfCurve(stablePoints, unstablePoints);
+}
+
+void printVfPrediction(const VfPrediction& prediction, double margin)
+{
+	std::cout << "FID " << +prediction.setting.fid << ", DID " << +prediction.setting.did
+		<< " (" << prediction.setting.frequencyMhz << " MHz): predicted " << prediction.predictedVcore
+		<< " V + " << margin * 1000 << " mV margin -> VID " << +prediction.vid
+		<< " (" << prediction.safeVcore << " V)" << std::endl;
+
+	if (prediction.extrapolated)
+	{
+		std::cout << "Warning: the frequency is above every known stable point, the voltage is extrapolated. "
+			"Certify it before use" << std::endl;
+	}
+}
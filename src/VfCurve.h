@@ -0,0 +1,58 @@
+﻿#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Certification.h"
+
+struct VfPoint
+{
+	double frequencyMhz{ 0 };
+	double vcore{ 0 };
+	std::string source; // "P0" ... for pstate definitions, the certification result for database records
+};
+
+struct FrequencySetting
+{
+	uint8_t fid{ 0 };
+	uint8_t did{ 0 };
+	double frequencyMhz{ 0 };
+};
+
+struct VfPrediction
+{
+	FrequencySetting setting;
+	double predictedVcore{ 0 }; // from the curve, without margin
+	double safeVcore{ 0 }; // with margin and above every known unstable voltage
+	uint8_t vid{ 0 }; // VID of safeVcore
+	bool extrapolated{ false }; // above the highest known stable frequency
+};
+
+// FID/DID combination within the limits that comes closest to the target frequency
+FrequencySetting findFrequencySetting(double targetMhz);
+
+// voltage/frequency curve through known stable points. a frequency that is stable at some voltage
+// is also stable at any lower frequency, so the curve is the lowest voltage known to be stable at
+// or above each frequency, linearly interpolated in between
+class VfCurve
+{
+public:
+	VfCurve(const std::vector<VfPoint>& stablePoints, const std::vector<VfPoint>& unstablePoints);
+
+	// lowest voltage the curve considers stable at the frequency
+	double predictVcore(double frequencyMhz) const;
+
+	// setting and VID for the target frequency, margin in volts
+	VfPrediction predict(double targetMhz, double margin) const;
+
+	void print() const;
+
+private:
+	std::vector<VfPoint> points; // ascending frequency, non decreasing voltage
+	std::vector<VfPoint> unstablePoints;
+};
+
+// curve from the definitions of all enabled pstates and the points of the certification database
+VfCurve buildVfCurve(const CertificationDatabase& certifications);
+
+void printVfPrediction(const VfPrediction& prediction, double margin);
@@ -0,0 +1,59 @@
+﻿#include "VoltageOffset.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+std::vector<PowerState> applyVoltageOffset(const std::vector<PowerState>& powerStates, double offsetMv)
+{
+	std::vector<PowerState> result;
+
+	for (const PowerState& powerState : powerStates)
+	{
+		int vid = PowerState::calculateVid(powerState.calculateVcore() + offsetMv / 1000);
+		vid = std::min(std::max(vid, (int)PowerState::VID_MIN), (int)PowerState::VID_MAX);
+
+		PowerState offset = powerState;
+		offset.setVid(vid);
+
+		// a lower pstate runs at a higher frequency and may never get less voltage
+		if (!result.empty() && offset.calculateVcore() > result.back().calculateVcore())
+		{
+			std::ostringstream errorMessage;
+			errorMessage << "P" << offset.getPstate() << " would get a higher voltage (" << offset.calculateVcore()
+				<< " V) than P" << result.back().getPstate() << " (" << result.back().calculateVcore()
+				<< " V), fix the pstate definitions before applying an offset";
+			throw std::invalid_argument(errorMessage.str());
+		}
+
+		result.push_back(offset);
+	}
+
+	return result;
+}
+
+void printVoltageOffset(const std::vector<PowerState>& before, const std::vector<PowerState>& after)
+{
+	std::cout << std::left << std::setw(8) << "Pstate" << std::setw(10) << "MHz" << std::setw(12) << "VID"
+		<< "VCore (V)" << std::endl;
+
+	for (size_t i = 0; i < before.size() && i < after.size(); i++)
+	{
+		std::ostringstream vid;
+		vid << +before[i].getVid() << " -> " << +after[i].getVid();
+
+		std::cout << std::setw(8) << ("P" + std::to_string(before[i].getPstate()))
+			<< std::setw(10) << before[i].calculateFrequency() << std::setw(12) << vid.str()
+			<< before[i].calculateVcore() << " -> " << after[i].calculateVcore();
+
+		if (after[i].getVid() == PowerState::VID_MIN || after[i].getVid() == PowerState::VID_MAX)
+		{
+			std::cout << " (at the VID limit)";
+		}
+		std::cout << std::endl;
+	}
+
+	std::cout << std::right;
+}
@@ -0,0 +1,11 @@
+﻿#pragma once
+#include <vector>
+
+#include "PowerState.h"
+
+// the definitions with the voltage of every pstate moved by the same offset (negative: undervolt).
+// a VID step is 6.25 mV, the VIDs are rounded towards the higher voltage and clamped to the VID
+// limits. throws if the voltage doesn't decrease (or stay the same) from each pstate to the next
+std::vector<PowerState> applyVoltageOffset(const std::vector<PowerState>& powerStates, double offsetMv);
+
+void printVoltageOffset(const std::vector<PowerState>& before, const std::vector<PowerState>& after);
@@ -0,0 +1,162 @@
+﻿#include "WakeLatency.h"
+
+#include <atomic>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+#include "CState.h"
+#include "Statistics.h"
+#include "Threads.h"
+#include "Tsc.h"
+
+// constants
+// time the sleeper gets to drop into a deep C-state before it is woken up again
+static constexpr DWORD IDLE_PERIOD_MS{ 2 };
+
+// prototypes
+static void setCStates(bool enabled, DWORD_PTR mask);
+static void restoreCStates(const std::vector<int>& threads, const std::vector<CStateConfig>& configs);
+
+std::vector<uint64_t> measureWakeLatency(int wakerThread, int sleeperThread, int samples)
+{
+	HANDLE wakeEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+	HANDLE doneEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+	if (!wakeEvent || !doneEvent)
+	{
+		throw std::runtime_error("Failed to create wake up events");
+	}
+
+	std::atomic<uint64_t> wakeTimestamp{ 0 };
+	std::vector<uint64_t> latencies;
+	latencies.reserve(samples);
+	// one per thread, both threads may fail at the same time
+	std::exception_ptr error;
+	std::exception_ptr wakerError;
+
+	std::thread sleeper([&]() {
+		try
+		{
+			pinCurrentThread(sleeperThread);
+		}
+		catch (...)
+		{
+			error = std::current_exception();
+		}
+
+		// keep the handshake going even on error, so the waker doesn't block forever
+		for (int i = 0; i < samples; i++)
+		{
+			SetEvent(doneEvent);
+			WaitForSingleObject(wakeEvent, INFINITE);
+			uint64_t now = readTsc();
+			latencies.push_back(now - wakeTimestamp.load(std::memory_order_acquire));
+		}
+	});
+
+	std::thread waker([&]() {
+		try
+		{
+			pinCurrentThread(wakerThread);
+		}
+		catch (...)
+		{
+			wakerError = std::current_exception();
+		}
+
+		for (int i = 0; i < samples; i++)
+		{
+			WaitForSingleObject(doneEvent, INFINITE);
+			Sleep(IDLE_PERIOD_MS);
+			wakeTimestamp.store(readTsc(), std::memory_order_release);
+			SetEvent(wakeEvent);
+		}
+	});
+
+	waker.join();
+	sleeper.join();
+
+	CloseHandle(wakeEvent);
+	CloseHandle(doneEvent);
+
+	// the sleeper's error takes precedence, it is the thread being measured
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
+
+	if (wakerError)
+	{
+		std::rethrow_exception(wakerError);
+	}
+
+	return latencies;
+}
+
+void runWakeLatencyBenchmark(DWORD_PTR sleeperMask, int wakerThread, int samples)
+{
+	DWORD_PTR wakerMask = (DWORD_PTR)1 << wakerThread;
+	DWORD_PTR benchmarkMask = sleeperMask | wakerMask;
+
+	// remember the configuration of every thread we are going to touch
+	std::vector<int> threads = getThreadsInMask(benchmarkMask);
+	std::vector<CStateConfig> originalConfigs;
+	for (int thread : threads)
+	{
+		originalConfigs.push_back(readCStateConfig((DWORD_PTR)1 << thread));
+	}
+
+	std::cout << "Calibrating TSC frequency..." << std::endl;
+	double ticksPerUs = calibrateTscFrequency() / 1e6;
+	std::cout << "TSC frequency (MHz): " << ticksPerUs << std::endl;
+
+	try
+	{
+		for (bool cstatesEnabled : { true, false })
+		{
+			setCStates(cstatesEnabled, benchmarkMask);
+
+			for (int sleeperThread : getThreadsInMask(sleeperMask))
+			{
+				if (sleeperThread == wakerThread)
+				{
+					continue;
+				}
+
+				std::vector<uint64_t> latencies = measureWakeLatency(wakerThread, sleeperThread, samples);
+
+				std::cout << "--------------------------------------------------\n"
+					<< "C-states " << (cstatesEnabled ? "enabled" : "disabled")
+					<< ", waker thread " << wakerThread
+					<< ", sleeper thread " << sleeperThread << std::endl;
+				printDistribution(summarize(latencies, 1.0 / ticksPerUs), "us");
+			}
+		}
+	}
+	catch (...)
+	{
+		restoreCStates(threads, originalConfigs);
+		throw;
+	}
+
+	restoreCStates(threads, originalConfigs);
+
+	std::cout << "--------------------------------------------------\n"
+		<< "C-state configuration restored" << std::endl;
+}
+
+static void setCStates(bool enabled, DWORD_PTR mask)
+{
+	setCc6Enabled(enabled, mask);
+	setPc6Enabled(enabled, mask);
+}
+
+static void restoreCStates(const std::vector<int>& threads, const std::vector<CStateConfig>& configs)
+{
+	for (size_t i = 0; i < threads.size(); i++)
+	{
+		setCc6Enabled(configs[i].cc6Enabled, (DWORD_PTR)1 << threads[i]);
+		setPc6Enabled(configs[i].pc6Enabled, (DWORD_PTR)1 << threads[i]);
+	}
+}
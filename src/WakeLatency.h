@@ -0,0 +1,14 @@
+﻿#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <Windows.h>
+
+// measures how long it takes for a thread blocked on an event to start running again after
+// another thread signals it. both threads are pinned, the signal time and the wake up time are
+// taken with RDTSC, so the result is in TSC ticks
+std::vector<uint64_t> measureWakeLatency(int wakerThread, int sleeperThread, int samples);
+
+// runs the wake latency measurement for every sleeper thread, once with core and package C6
+// enabled and once with them disabled. the original C-state configuration is restored afterwards
+void runWakeLatencyBenchmark(DWORD_PTR sleeperMask, int wakerThread, int samples);